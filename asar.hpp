@@ -1,87 +1,4202 @@
 #pragma once
 
-#include "json.hpp"
+#include "sha256.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// POSIX gives the archive a mapping and positional reads. Elsewhere (e.g.
+// Windows) it is read through std::ifstream instead, without a mapping;
+// index files are never used there, and Async, Writer, Updater, sendTo(),
+// extractAll(), repack() and profiles are left out. Define ASAR_PORTABLE
+// to build the fallback on POSIX too.
+#if !defined(ASAR_PORTABLE) && (defined(__unix__) || defined(__APPLE__))
+#define ASAR_POSIX 1
+#endif
+
+#ifdef ASAR_POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#else
 #include <fstream>
+#endif
+
+#if !defined(ASAR_POSIX) && defined(_MSC_VER)
+#include <BaseTsd.h>
+typedef SSIZE_T ssize_t;
+#endif
+
+#if defined(__linux__) && defined(ASAR_POSIX)
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(ASAR_POSIX) && __has_include(<linux/io_uring.h>) && !defined(ASAR_NO_IO_URING)
+#include <linux/io_uring.h>
+#define ASAR_IO_URING 1
+#endif
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define ASAR_COROUTINES 1
+#endif
+
+// Lets constexpr code (Asar::Embedded) compare with memcmp at run time.
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_is_constant_evaluated)
+#define ASAR_CONSTANT_EVALUATED 1
+#endif
+#elif defined(__GNUC__) && __GNUC__ >= 9
+#define ASAR_CONSTANT_EVALUATED 1
+#endif
+
+#ifdef ASAR_POSIX
+static_assert(sizeof(off_t) >= 8, "asar.hpp needs 64-bit file offsets (-D_FILE_OFFSET_BITS=64)");
+#endif
 
 class Asar {
   public:
-    Asar(const std::string _filename) {
-      filename = _filename;
+    enum Flags : uint32_t {
+      Directory  = 1 << 0,
+      Unpacked   = 1 << 1,
+      Executable = 1 << 2,
+      Link       = 1 << 3
+    };
+
+    // Links are resolved when the index is built: offset holds the index + 1
+    // of the entry the chain finally leads to (0 when it dangles or loops)
+    // and size is that entry's size. Unpacked entries have no offset; their
+    // bytes are in a file of the same path under "<archive>.unpacked/".
+    struct Entry {
+      uint64_t offset; // relative to the start of the file data
+      uint64_t size;
+      uint32_t name;   // offset of the normalized path in names
+      uint32_t length;
+      uint32_t flags;
+      uint32_t integrity; // index + 1 into integrities, 0 when absent
+
+      bool isDirectory() const { return flags & Directory; }
+      bool isUnpacked() const { return flags & Unpacked; }
+      bool isExecutable() const { return flags & Executable; }
+      bool isLink() const { return flags & Link; }
+    };
+
+    struct Integrity {
+      uint64_t blockSize;
+      uint32_t first; // first block digest in digests
+      uint32_t count;
+    };
+
+    static_assert(sizeof(Entry) == 32 && sizeof(Integrity) == 16, "index records are stored verbatim in index files");
+
+    struct CacheStats {
+      uint64_t hits;
+      uint64_t misses;
+      uint64_t evictions;
+      uint64_t bytes;
+    };
+
+    // Latency histogram with power-of-two buckets: buckets[b] counts calls
+    // that took less than 2^b ns (and at least 2^(b-1)).
+    struct Histogram {
+      static constexpr size_t size = 48;
+
+      uint64_t buckets[size];
+      uint64_t count;
+      uint64_t nanoseconds; // total
+
+      // Upper bound of the bucket holding the p-th quantile, p in [0, 1].
+      uint64_t percentile(double p) const {
+        uint64_t wanted = uint64_t(p * count + 0.5), seen = 0;
+        for (size_t b = 0; b < size; b++)
+          if ((seen += buckets[b]) >= std::max<uint64_t>(wanted, 1)) return uint64_t(1) << b;
+        return count ? uint64_t(1) << (size - 1) : 0;
+      }
+    };
+
+    struct Stats {
+      uint64_t lookups;
+      uint64_t hits;
+      uint64_t misses;
+      uint64_t bytes;  // delivered from the archive, copied or read
+      uint64_t reads;  // read syscalls against the archive
+      uint64_t cacheHits;
+      Histogram resolve;
+      Histogram unpack;
+    };
+
+    // Streaming access to one entry through positional reads on the archive
+    // descriptor. read() copies straight into the caller's buffer; the
+    // streambuf interface (std::istream in(&reader)) uses one fixed-size
+    // buffer, so memory use does not depend on the entry size.
+    class Async;
+    class Writer;
+    class Updater;
+    class Overlay;
+    template <size_t Capacity> class Embedded;
+
+    class Reader : public std::streambuf {
+      public:
+        static constexpr size_t capacity = 64 * 1024;
+
+        Reader() = default;
+        Reader(const Asar & _asar, const Entry & _entry) : asar(&_asar), entry(&_entry), length(_entry.size) {
+          Source source = _asar.source(_entry);
+          fd = source.in;
+          base = source.base;
+          file = std::move(source.file);
+        }
+
+        Reader(Reader && other) : std::streambuf(other), asar(other.asar), entry(other.entry), fd(other.fd),
+          base(other.base), length(other.length), position(other.position), buffer(std::move(other.buffer)),
+          file(std::move(other.file)) {
+          other.setg(nullptr, nullptr, nullptr);
+          other.fd = -1;
+        }
+
+        explicit operator bool() const { return fd != -1; }
+
+        uint64_t size() const { return length; }
+        uint64_t tell() const { return position - (egptr() - gptr()); }
+
+        bool seek(uint64_t to) {
+          if (to > length) return false;
+          setg(nullptr, nullptr, nullptr);
+          position = to;
+          return true;
+        }
+
+        size_t read(char * out, size_t n) {
+          size_t done = std::min<size_t>(n, egptr() - gptr());
+          if (done) { std::memcpy(out, gptr(), done); gbump(done); }
+
+          while (done < n && position < length) {
+            size_t want = std::min<uint64_t>(n - done, length - position);
+            if (!asar->verified(*entry, position, want)) break;
+            ssize_t got = pull(out + done, want);
+            if (got <= 0) break;
+            asar->count(Bytes, got);
+            done += got;
+            position += got;
+          }
+
+          return done;
+        }
+
+      protected:
+        int_type underflow() override {
+          if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+          if (fd == -1 || position >= length) return traits_type::eof();
+
+          if (!buffer) buffer.reset(new char[capacity]);
+          size_t want = std::min<uint64_t>(capacity, length - position);
+          if (!asar->verified(*entry, position, want)) return traits_type::eof();
+          ssize_t got = pull(buffer.get(), want);
+          if (got <= 0) return traits_type::eof();
+          asar->count(Bytes, got);
+
+          position += got;
+          setg(buffer.get(), buffer.get(), buffer.get() + got);
+          return traits_type::to_int_type(*gptr());
+        }
+
+        std::streamsize showmanyc() override {
+          return tell() < length ? std::streamsize(length - tell()) : -1;
+        }
+
+        std::streamsize xsgetn(char * out, std::streamsize n) override {
+          return read(out, n);
+        }
+
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) override {
+          off_type from = dir == std::ios_base::beg ? 0 : dir == std::ios_base::cur ? off_type(tell()) : off_type(length);
+          if (from + off < 0 || !seek(from + off)) return pos_type(off_type(-1));
+          return pos_type(off_type(position));
+        }
+
+        pos_type seekpos(pos_type pos, std::ios_base::openmode mode) override {
+          return seekoff(off_type(pos), std::ios_base::beg, mode);
+        }
+
+      private:
+        ssize_t pull(char * out, size_t want) {
+          if (fd == inMemory) {
+            std::memcpy(out, asar->mapping + base + position, want);
+            return want;
+          }
+          asar->count(Reads);
+          return readFile(fd, out, want, base + position);
+        }
+
+        const Asar * asar = nullptr;
+        const Entry * entry = nullptr;
+        int fd = -1;
+        uint64_t base = 0;
+        uint64_t length = 0;
+        uint64_t position = 0;
+        std::unique_ptr<char[]> buffer;
+        std::shared_ptr<const int> file; // holds an unpacked entry's descriptor open
+    };
+
+    // With an index path, the lookup index is taken from that file when it
+    // matches the archive (size, mtime, inode and a header fingerprint) and
+    // is used in place, straight from the mapping; otherwise the header is
+    // parsed as usual and the index file is (re)written for the next start.
+    // A path under /dev/shm gives every process the same physical copy.
+    Asar(const std::string _filename, const std::string _index = "") {
+      load(_filename, _index, -1);
+    }
+
+    enum class Load { Eager, Lazy };
+
+    // Lazy: only the top level of the header is parsed up front; each
+    // directory's "files" object is skipped by brace matching and parsed the
+    // first time a lookup descends into it (once, thread-safely). Calls that
+    // need the whole tree (extractAll, verification, index files) parse the
+    // rest on first use.
+    Asar(const std::string _filename, Load mode) {
+      lazy = mode == Load::Lazy;
+      load(_filename, "", -1);
+    }
+
+    // Attaches read-only to an index image another process published, e.g.
+    // the descriptor a parent got from shareIndex() before forking workers.
+    // Falls back to parsing the header if the image does not match.
+    Asar(const std::string _filename, int _index) {
+      load(_filename, "", _index);
+    }
+
+    // An archive already in memory, e.g. compiled into the program (see
+    // also Embedded). The bytes are used in place and must outlive the
+    // Asar. Without a file there are no unpacked entries, and prefetch(),
+    // repack() and index files are unavailable.
+    struct Memory {
+      const void * data;
+      size_t size;
+    };
+
+    explicit Asar(Memory memory, Load mode = Load::Eager) {
+      lazy = mode == Load::Lazy;
+      fd = inMemory;
+      mapping = (const char *)memory.data;
+      length = memory.size;
+      parse("", -1);
+    }
+
+    Asar(const Asar &) = delete;
+    Asar & operator=(const Asar &) = delete;
+
+    ~Asar() {
+      if (prefetcher.joinable()) {
+        stopping = true;
+        prefetcher.join();
+      }
+#ifdef ASAR_POSIX
+      if (profile) saveProfile();
+
+      if (indexMapping) munmap((void *)indexMapping, indexLength);
+      if (mapping && fd != inMemory) munmap((void *)mapping, length);
+#endif
+      if (fd >= 0) closeFile(fd);
+    }
+
+    // Moves the index into a sealed, read-only memfd and switches this Asar
+    // over to it, so the index exists once no matter how many workers attach
+    // with Asar(filename, descriptor). The descriptor is close-on-exec; it
+    // survives fork() but must be handed over explicitly across exec().
+    // Returns -1 on failure. Call before sharing this Asar across threads.
+    int shareIndex() {
+#if defined(__linux__) && defined(ASAR_POSIX)
+      if (fd < 0) return -1;
+      materialize();
+
+      int out = memfd_create("asar-index", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+      if (out < 0) return -1;
+
+      if (!writeIndex(out) || fcntl(out, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        ::close(out);
+        return -1;
+      }
+
+      if (!indexMapping) {
+        if (!mapIndex(out)) { ::close(out); return -1; }
+        built = Storage();
+      }
+      return out;
+#else
+      return -1;
+#endif
+    }
+
+    // Everything below is const and safe for concurrent use, so one Asar
+    // may be shared by any number of threads. The index is immutable once
+    // built and the mapping is read-only, so lookups and archive reads take
+    // no locks, with these exceptions:
+    // - reads of unpacked entries lock the descriptor pool
+    // - unpackShared() locks one cache shard
+    // - with recordProfile() on, reads lock the profile
+    // - in lazy mode, a directory's first lookup and the first call that
+    //   needs the whole tree parse under std::call_once
+    // - with -DASAR_STATS, a thread's first counted call registers its meter
+    // - without POSIX, every read locks its stream
+
+    const Entry * resolve(std::string_view path) const {
+      Timer timer(*this, Resolving);
+      const Entry * e = locate(path);
+      count(e ? Hits : Misses);
+      return e;
+    }
+
+    // Zero-copy access: the returned view points straight into the mapped
+    // archive and stays valid for the lifetime of this Asar. Empty when the
+    // archive could not be mapped or the entry is unpacked; unpack() still
+    // works then.
+    std::string_view view(const std::string_view path) const {
+      auto * c = resolve(path);
+      if (!exist(c) || !mapped(*c)) return {};
+
+      note(path);
+      count(Bytes, c->size);
+      return std::string_view(mapping + offset + c->offset, c->size);
+    }
+
+    std::string unpack(const std::string_view path) const {
+      Timer timer(*this, Unpacking);
+      auto * c = resolve(path);
+      std::string data;
+      if (exist(c) && !c->isDirectory() && load(*c, data)) note(path);
+      return data;
+    }
+
+    // Bytes [from, from + size) of an entry, e.g. for an HTTP Range request.
+    // size is clamped to the end of the entry; a range starting past it is
+    // empty. Only the blocks the range overlaps are read and verified.
+    std::string read(const std::string_view path, uint64_t from, uint64_t size) const {
+      auto * c = resolve(path);
+      std::string data;
+      if (exist(c) && slice(*c, from, size, data)) note(path);
+      return data;
+    }
+
+#ifdef ASAR_POSIX
+    // The same range written to out (a socket, pipe or file, at its current
+    // position) by sendfile(), straight from the archive or unpacked file,
+    // without a copy through user space. Blocks until everything is
+    // written, also when out is non-blocking.
+    bool sendTo(const std::string_view path, int out, uint64_t from = 0, uint64_t size = std::numeric_limits<uint64_t>::max()) const {
+      auto * c = resolve(path);
+      if (!exist(c) || !send(*c, out, from, size)) return false;
+      note(path);
+      return true;
+    }
+#endif
+
+    // Batched unpack. Entries are read in archive order, and neighbours
+    // separated by at most gap bytes are fetched together: by one preadv()
+    // that scatters straight into the results, or with the archive mapped,
+    // by one readahead request for the merged range ahead of the copies. A
+    // page worth of assets turns into a few sequential reads. Results
+    // follow the order of paths.
+    std::vector<std::string> unpackMany(const std::vector<std::string_view> & paths, uint64_t gap = 64 * 1024) const {
+      std::vector<std::string> results(paths.size());
+      std::vector<std::pair<const Entry *, size_t>> order;
+
+      for (size_t i = 0; i < paths.size(); i++) {
+        auto * c = resolve(paths[i]);
+        if (!exist(c) || c->isDirectory()) continue;
+        if (c->isUnpacked() && load(*c, results[i])) note(paths[i]);
+        if (c->isUnpacked() || !c->size || !inside(*c)) continue;
+        order.emplace_back(c, i);
+        note(paths[i]);
+      }
+
+      std::sort(order.begin(), order.end(), [](auto & a, auto & b) {
+        return a.first->offset != b.first->offset ? a.first->offset < b.first->offset : a.second < b.second;
+      });
 
-      std::ifstream stream(filename);
+#ifdef ASAR_POSIX
+      std::string skipped(mapping ? 0 : gap, '\0');
+      std::vector<iovec> iov;
+      std::vector<size_t> members;
+      uint64_t page = sysconf(_SC_PAGESIZE);
 
-      char * size = new char[8];
-      stream.read(size, 8);
+      for (size_t i = 0; i < order.size();) {
+        uint64_t start = order[i].first->offset, end = start;
+        iov.clear();
+        members.clear();
 
-      uint32_t uSize = *(uint32_t*)(size + 4) - 8;
+        for (; i < order.size() && iov.size() + 2 <= IOV_MAX; i++) {
+          const Entry * e = order[i].first;
 
-      char *buffer = new char[uSize + 1];
-      buffer[uSize] = '\0';
+          // The same entry requested twice is copied once the read is done.
+          if (!members.empty() && order[members.back()].first == e) { members.push_back(i); continue; }
+          if (e->offset < end || e->offset - end > gap) break;
 
-      stream.seekg(16);
-      stream.read(buffer, uSize);
+          if (!mapping) {
+            std::string & out = results[order[i].second];
+            if (e->offset > end) iov.push_back({&skipped[0], size_t(e->offset - end)});
+            out.resize(e->size);
+            iov.push_back({&out[0], size_t(e->size)});
+          }
+          members.push_back(i);
+          end = e->offset + e->size;
+        }
 
-      header = json::JSON::Load(buffer);
-      offset = uSize + 16;
+        // Mapped, the copies would fault a merged range in a page or a
+        // small readahead window at a time; one request lets the kernel read
+        // it in large chunks first. A lone entry gains nothing from that,
+        // and the caller's memory is left alone.
+        if (mapping) {
+          if (fd != inMemory && order[members.front()].first != order[members.back()].first) {
+            uint64_t aligned = (offset + start) & ~(page - 1);
+            madvise((void *)(mapping + aligned), offset + end - aligned, MADV_WILLNEED);
+          }
+          for (size_t k : members) load(*order[k].first, results[order[k].second]);
+          continue;
+        }
 
-      delete[] size;
-      delete[] buffer;
+        uint64_t done = 0, total = end - start;
+        size_t first = 0;
+        while (done < total) {
+          ssize_t n = preadv(fd, iov.data() + first, iov.size() - first, offset + start + done);
+          count(Reads);
+          if (n <= 0) break;
+          count(Bytes, n);
+          done += n;
+          while (first < iov.size() && size_t(n) >= iov[first].iov_len) n -= iov[first++].iov_len;
+          if (n) { iov[first].iov_base = (char *)iov[first].iov_base + n; iov[first].iov_len -= n; }
+        }
 
-      stream.close();
+        for (size_t k = 0; k < members.size(); k++) {
+          const Entry * e = order[members[k]].first;
+          std::string & out = results[order[members[k]].second];
+          if (k && order[members[k - 1]].first == e) out = results[order[members[k - 1]].second];
+          else if (done < total || !verified(*e, 0, e->size)) out.clear();
+        }
+      }
+#else
+      (void)gap;
+      for (auto & o : order) load(*o.first, results[o.second]); // one read each, without preadv()
+#endif
+
+      return results;
+    }
+
+    // Opt-in LRU cache for hot entries, bounded to bytes in total and split
+    // into independently locked shards. Each shard keeps to its share of
+    // the budget unless the others have room, so any entry up to bytes can
+    // be cached. Call before sharing the Asar.
+    void enableCache(size_t bytes, unsigned shards = 16) {
+      cache.reset(new Cache(bytes, std::max(1u, shards)));
     }
 
-    std::string unpack(const std::string path) {
+    // Like unpack(), but the buffer is shared with the cache: a hit costs a
+    // lookup and a reference count, never a copy.
+    std::shared_ptr<const std::string> unpackShared(const std::string_view path) const {
       auto * c = resolve(path);
-      
-      if (!exist(c)) return "";
 
-      uint64_t _size = std::stoull(c->at("size").stringify());
-      uint64_t _offset = std::stoull(c->at("offset").ToString());
+      if (!exist(c) || c->isDirectory()) return nullptr;
+      if (!cache) {
+        std::string data;
+        if (!load(*c, data)) return nullptr;
+        note(path);
+        return std::make_shared<const std::string>(std::move(data));
+      }
+      note(path);
+
+      size_t s = (uintptr_t(c) / sizeof(Entry)) % cache->shards.size();
+      Cache::Shard & shard = cache->shards[s];
+      {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(c);
+        if (it != shard.index.end()) {
+          shard.order.splice(shard.order.begin(), shard.order, it->second);
+          cache->hits++;
+          count(CacheHits);
+          return it->second->second;
+        }
+      }
+
+      cache->misses++;
+      std::string data;
+      if (!load(*c, data)) return nullptr;
+
+      auto buffer = std::make_shared<const std::string>(std::move(data));
+      if (buffer->size() > cache->budget) return buffer;
+
+      {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(c);
+        if (it != shard.index.end()) return it->second->second;
+
+        shard.order.emplace_front(c, buffer);
+        shard.index[c] = shard.order.begin();
+        shard.bytes += buffer->size();
+        cache->bytes += buffer->size();
+
+        while (shard.bytes > cache->share && cache->bytes > cache->budget && shard.order.back().first != c) cache->evict(shard);
+      }
+
+      // Still over budget: take the least recent entries of the other
+      // shards, one lock at a time, and then this one's.
+      for (size_t i = 1; i <= cache->shards.size() && cache->bytes > cache->budget; i++) {
+        Cache::Shard & other = cache->shards[(s + i) % cache->shards.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        while (cache->bytes > cache->budget && !other.order.empty() && other.order.back().first != c) cache->evict(other);
+      }
+
+      return buffer;
+    }
+
+    CacheStats cacheStats() const {
+      CacheStats stats{};
+      if (!cache) return stats;
+
+      stats.hits = cache->hits;
+      stats.misses = cache->misses;
+      stats.evictions = cache->evictions;
+      for (auto & shard : cache->shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.bytes += shard.bytes;
+      }
+      return stats;
+    }
+
+    // Counters and latency histograms, summed over all threads at the time
+    // of the call. They are only collected when compiled with -DASAR_STATS;
+    // otherwise every hook compiles away and this returns zeros.
+    Stats stats() const {
+      Stats out{};
+#ifdef ASAR_STATS
+      std::lock_guard<std::mutex> lock(meters.mutex);
+      for (const Meter & m : meters.threads) {
+        out.hits += m.counts[Hits].load(std::memory_order_relaxed);
+        out.misses += m.counts[Misses].load(std::memory_order_relaxed);
+        out.bytes += m.counts[Bytes].load(std::memory_order_relaxed);
+        out.reads += m.counts[Reads].load(std::memory_order_relaxed);
+        out.cacheHits += m.counts[CacheHits].load(std::memory_order_relaxed);
+
+        for (size_t t = 0; t < Timings; t++) {
+          Histogram & h = t == Resolving ? out.resolve : out.unpack;
+          for (size_t b = 0; b < Histogram::size; b++) {
+            uint64_t n = m.buckets[t][b].load(std::memory_order_relaxed);
+            h.buckets[b] += n;
+            h.count += n;
+          }
+          h.nanoseconds += m.nanoseconds[t].load(std::memory_order_relaxed);
+        }
+      }
+      out.lookups = out.hits + out.misses;
+#endif
+      return out;
+    }
+
+    // stats() in the Prometheus text exposition format, ready to be served
+    // from a metrics endpoint.
+    std::string exportStats() const {
+      Stats s = stats();
+      std::string out;
 
-      char * buffer = new char[_size];
-      std::ifstream stream(filename, std::ios::binary);
-      std::stringstream data;
+      auto counter = [&](const char * name, const char * help, uint64_t value) {
+        out += std::string("# HELP asar_") + name + ' ' + help + "\n# TYPE asar_" + name + " counter\n";
+        out += std::string("asar_") + name + ' ' + std::to_string(value) + '\n';
+      };
+      counter("lookups_total", "Path lookups.", s.lookups);
+      counter("lookup_hits_total", "Lookups that found an entry.", s.hits);
+      counter("lookup_misses_total", "Lookups that found nothing.", s.misses);
+      counter("read_bytes_total", "Bytes delivered from the archive.", s.bytes);
+      counter("read_syscalls_total", "Read system calls against the archive.", s.reads);
+      counter("cache_hits_total", "unpackShared() calls served by the cache.", s.cacheHits);
 
-      stream.seekg(offset + _offset);
-      stream.read(buffer, _size);
-      stream.close();
-      
-      data.write(buffer, _size);
+      auto seconds = [](uint64_t ns) {
+        char text[32];
+        std::snprintf(text, sizeof text, "%.9g", ns / 1e9);
+        return std::string(text);
+      };
 
-      delete[] buffer;
+      auto histogram = [&](const char * name, const char * help, const Histogram & h) {
+        out += std::string("# HELP asar_") + name + ' ' + help + "\n# TYPE asar_" + name + " histogram\n";
+        uint64_t seen = 0;
+        for (size_t b = 0; b < Histogram::size; b++) {
+          seen += h.buckets[b];
+          out += std::string("asar_") + name + "_bucket{le=\"" + seconds(uint64_t(1) << b) + "\"} " + std::to_string(seen) + '\n';
+        }
+        out += std::string("asar_") + name + "_bucket{le=\"+Inf\"} " + std::to_string(h.count) + '\n';
+        out += std::string("asar_") + name + "_sum " + seconds(h.nanoseconds) + '\n';
+        out += std::string("asar_") + name + "_count " + std::to_string(h.count) + '\n';
+      };
+      histogram("resolve_seconds", "Latency of resolve().", s.resolve);
+      histogram("unpack_seconds", "Latency of unpack().", s.unpack);
 
-      return data.str();
+      return out;
     }
 
-    bool exist(const std::string path) {
+    Reader open(const std::string_view path) const {
       auto * c = resolve(path);
-      return !c->IsNull();
+
+      if (!exist(c) || c->isDirectory()) return Reader();
+      if (!inside(*c)) return Reader();
+
+      note(path);
+      return Reader(*this, *c);
+    }
+
+#ifdef ASAR_POSIX
+    // Rewrites the archive to output with the entries in order (an access
+    // log, e.g. a recorded profile) laid out first, contiguously and in
+    // first-access order, followed by the rest in their current order. Only
+    // the "offset" values of the header change; every other byte of it is
+    // kept. Data moves archive-to-file inside the kernel, on threads.
+    bool repack(const std::string & output, const std::vector<std::string_view> & order, unsigned threads = std::thread::hardware_concurrency()) const {
+      if (fd < 0) return false;
+      materialize();
+
+      std::string header(headerSize, '\0');
+      if (!readAt(&header[0], header.size(), headerAt)) return false;
+
+      Storage parsed;
+      Parser::Ranges values;
+      Parser parser(header.data(), header.data() + header.size(), parsed);
+      parser.offsets = &values;
+      if (!parser.parse()) return false;
+      values.resize(parsed.entries.size());
+      rehash(parsed);
+
+      std::vector<size_t> layout;
+      std::vector<bool> placed(parsed.entries.size());
+      auto place = [&](size_t i) {
+        const Entry & e = parsed.entries[i];
+        if (placed[i] || !values[i].first || (e.flags & (Directory | Unpacked))) return true;
+        if (!inside(e)) return false;
+        placed[i] = true;
+        layout.push_back(i);
+        return true;
+      };
+
+      // Paths resolve through links like any lookup; the entry they lead to
+      // is then found in parsed by its own path.
+      Table<char> names{parsed.names.data(), parsed.names.size()};
+      for (auto path : order) {
+        const Entry * e = locate(path);
+        if (e) e = probe(table(parsed.entries), table(parsed.slots), names, key(*e));
+        if (e && !place(e - parsed.entries.data())) return false;
+      }
+
+      std::vector<size_t> rest;
+      for (size_t i = 0; i < parsed.entries.size(); i++) rest.push_back(i);
+      std::stable_sort(rest.begin(), rest.end(), [&](size_t a, size_t b) { return parsed.entries[a].offset < parsed.entries[b].offset; });
+      for (size_t i : rest)
+        if (!place(i)) return false;
+
+      std::vector<uint64_t> moved(parsed.entries.size());
+      uint64_t total = 0;
+      for (size_t i : layout) { moved[i] = total; total += parsed.entries[i].size; }
+
+      // Offset values appear in entry order, so one pass splices them in.
+      std::string text;
+      const char * at = header.data(), * end = at + header.size();
+      for (size_t i = 0; i < values.size(); i++) {
+        if (!placed[i]) continue;
+        text.append(at, values[i].first);
+        text += '"' + std::to_string(moved[i]) + '"';
+        at = values[i].second;
+      }
+      text.append(at, end);
+
+      if (text.size() > std::numeric_limits<uint32_t>::max() - 16) return false;
+      uint8_t prefix[16];
+      pickle(text.size(), prefix);
+      size_t padded = (text.size() + 3) & ~size_t(3);
+      text.resize(padded, '\0');
+      uint64_t base = 16 + padded;
+
+      return replace(output, [&](int out) {
+        std::atomic<bool> ok{ftruncate(out, base + total) == 0 && pwrite(out, prefix, 16, 0) == 16 &&
+          pwrite(out, text.data(), padded, 16) == ssize_t(padded)};
+        parallel(layout.size(), threads, [&](size_t k) {
+          const Entry & e = parsed.entries[layout[k]];
+          if (ok && e.size && !copy(fd, offset + e.offset, out, base + moved[layout[k]], e.size)) ok = false;
+        });
+        return bool(ok);
+      });
+    }
+
+    // The same, with the order read from a file of paths, one per line.
+    bool repack(const std::string & output, const std::string & log, unsigned threads = std::thread::hardware_concurrency()) const {
+      std::string text;
+      if (!slurp(log, text)) return false;
+
+      std::vector<std::string_view> order;
+      for (size_t at = 0, end; at < text.size(); at = end + 1) {
+        end = text.find('\n', at);
+        if (end == std::string::npos) end = text.size();
+        order.push_back(std::string_view(text).substr(at, end - at));
+      }
+
+      return repack(output, order, threads);
+    }
+
+    // Rewrites an archive updated in place (see Updater) to output as a
+    // plain one, without the data its updates superseded.
+    bool compact(const std::string & output, unsigned threads = std::thread::hardware_concurrency()) const {
+      return repack(output, std::vector<std::string_view>(), threads);
     }
 
-    bool exist(const json::JSON * file) {
-      return !file->IsNull();
+    // Access profiles for warm starts. recordProfile() notes the first read
+    // of every entry, in order, and writes the paths (one per line) to file
+    // on saveProfile() or when this Asar is destroyed. prefetch() replays
+    // such a file on a background thread: it asks the kernel to read those
+    // byte ranges ahead (madvise on the mapping, fadvise otherwise), so the
+    // first unpacks after a start find them in the page cache. Call both
+    // right after construction, before the Asar is shared across threads.
+    void recordProfile(const std::string & file) {
+      profile.reset(new Profile{file, {}, {}, {}});
     }
 
+    bool saveProfile() const {
+      if (!profile) return false;
+
+      std::string text;
+      {
+        std::lock_guard<std::mutex> lock(profile->mutex);
+        for (auto & path : profile->order) text += path + '\n';
+      }
+
+      return replace(profile->file, [&](int out) {
+        return ::write(out, text.data(), text.size()) == ssize_t(text.size());
+      });
+    }
+
+    bool prefetch(const std::string & file) {
+      if (fd < 0 || prefetcher.joinable()) return false;
+
+      std::string text;
+      if (!slurp(file, text)) return false;
+
+      // Resolved up front, so the thread below only touches the descriptor
+      // and the mapping.
+      std::vector<std::pair<uint64_t, uint64_t>> ranges;
+      for (size_t at = 0, end; at < text.size(); at = end + 1) {
+        end = text.find('\n', at);
+        if (end == std::string::npos) end = text.size();
+
+        auto * c = locate(std::string_view(text).substr(at, end - at));
+        if (c && !c->isDirectory() && !c->isUnpacked() && c->size && inside(*c)) ranges.emplace_back(offset + c->offset, c->size);
+      }
+
+      prefetcher = std::thread([this, ranges = std::move(ranges)]() mutable { advise(ranges); });
+      return true;
+    }
+#endif
+
+    bool exist(const std::string_view path) const {
+      return exist(resolve(path));
+    }
+
+    bool exist(const Entry * file) const {
+      return file != nullptr;
+    }
+
+    // Read-only view of a contiguous array, like a span: the index tables,
+    // and the runs of entries walk() returns.
+    template <typename T>
+    struct Table {
+      const T * data = nullptr;
+      size_t count = 0;
+
+      const T * begin() const { return data; }
+      const T * end() const { return data + count; }
+      size_t size() const { return count; }
+      bool empty() const { return count == 0; }
+      const T & operator[](size_t i) const { return data[i]; }
+    };
+
+    // The direct children of a directory, found while iterating: a child's
+    // own subtree need not follow it ("lib-x" and "lib.y" sort between
+    // "lib" and "lib/a"), so the scan jumps only on reaching a nested
+    // entry, past the rest of that child's subtree.
+    class Children {
+      public:
+        class iterator {
+          public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Entry;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Entry *;
+            using reference = const Entry &;
+
+            const Entry & operator*() const { return *e; }
+            const Entry * operator->() const { return e; }
+            iterator & operator++() { e = children->next(e + 1); return *this; }
+            iterator operator++(int) { iterator old = *this; ++*this; return old; }
+            bool operator==(const iterator & other) const { return e == other.e; }
+            bool operator!=(const iterator & other) const { return e != other.e; }
+
+          private:
+            friend class Children;
+            iterator(const Children * _children, const Entry * _e) : children(_children), e(_e) {}
+
+            const Children * children;
+            const Entry * e;
+        };
+
+        iterator begin() const { return iterator(this, next(first)); }
+        iterator end() const { return iterator(this, last); }
+        bool empty() const { return begin() == end(); }
+
+      private:
+        friend class Asar;
+        Children(const Asar & _asar, std::pair<const Entry *, const Entry *> range, size_t _base) :
+          asar(_asar), first(range.first), last(range.second), base(_base) {}
+
+        const Entry * next(const Entry * e) const {
+          while (e < last) {
+            std::string_view path = asar.key(*e);
+            size_t slash = path.find('/', base);
+            if (slash == std::string_view::npos) return e;
+            e = asar.after(path.substr(0, slash), e, last);
+          }
+          return last;
+        }
+
+        const Asar & asar;
+        const Entry * first, * last;
+        size_t base; // where names below the directory start
+    };
+
+    // Queries over the path-sorted index. They return metadata only; nothing
+    // is read from the archive. A subtree is one contiguous range of the
+    // index, found by binary search. The results view the index and stay
+    // valid as long as the Asar.
+
+    // Direct children of dir ("" or "/" for the root), in path order.
+    Children list(std::string_view dir) const {
+      size_t base = normalize(dir).size();
+      return Children(*this, subtree(dir), base ? base + 1 : 0);
+    }
+
+    // Every entry below dir, depth-first in path order: [first, last) of
+    // the index itself, nothing is copied.
+    Table<Entry> walk(std::string_view dir) const {
+      auto range = subtree(dir);
+      return {range.first, size_t(range.second - range.first)};
+    }
+
+    // Entries matching pattern: '?' and '*' match within one path component,
+    // "**" matches any number of components. Only the subtree under the
+    // pattern's literal leading components is scanned. Unlike list() and
+    // walk() the matches are collected up front, as a pattern without
+    // wildcards may resolve through a link to an entry outside that subtree.
+    std::vector<const Entry *> glob(std::string_view pattern) const {
+      std::string wanted(normalize(pattern));
+      std::vector<const Entry *> out;
+
+      size_t wild = wanted.find_first_of("*?");
+      if (wild == std::string::npos) {
+        materialize();
+        if (const Entry * e = locate(wanted)) out.push_back(e);
+        return out;
+      }
+
+      size_t slash = wanted.rfind('/', wild);
+      auto range = subtree(slash == std::string::npos ? std::string_view() : std::string_view(wanted).substr(0, slash));
+
+      for (const Entry * e = range.first; e < range.second; e++)
+        if (match(wanted, key(*e))) out.push_back(e);
+
+      return out;
+    }
+
+    // The normalized path of an entry returned by list(), walk() or glob().
+    std::string_view path(const Entry & entry) const {
+      return key(entry);
+    }
+
+    // Writes the lookup index to path (atomically, through a rename) so a
+    // later Asar(filename, path) can start without parsing the header.
+    // Always fails without POSIX.
+    bool saveIndex(const std::string & path) const {
+#ifdef ASAR_POSIX
+      if (fd < 0) return false;
+      materialize();
+
+      return replace(path, [&](int out) { return writeIndex(out); });
+#else
+      (void)path;
+      return false;
+#endif
+    }
+
+    // Off by default. When enabled, each integrity block of an entry is
+    // hashed against the header's SHA-256 digest the first time a read
+    // touches it; the verdict is cached per block, so later reads are free.
+    // Set this before sharing the Asar across threads.
+    void verifyOnRead(bool enabled) {
+      if (enabled) materialize();
+      verifying = enabled;
+    }
+
+    bool verify(const std::string_view path) const {
+      materialize();
+      auto * c = locate(path);
+      if (!exist(c) || c->isDirectory()) return false;
+      if (!inside(*c)) return false;
+      return check(*c, 0, c->size);
+    }
+
+    // Hashes every block of every entry, spreading blocks across threads.
+    bool verifyAll(unsigned threads = std::thread::hardware_concurrency()) const {
+      materialize();
+      std::vector<std::pair<const Entry *, uint32_t>> blocks;
+      bool ok = true;
+
+      for (auto & e : entries) {
+        if (!e.integrity) continue;
+        if (!inside(e)) { ok = false; continue; }
+        const Integrity & in = integrities[e.integrity - 1];
+        if (!counted(e, in)) { ok = false; continue; }
+        for (uint32_t b = 0; b < in.count; b++) blocks.emplace_back(&e, b);
+      }
+
+      std::atomic<bool> good{ok};
+      parallel(blocks.size(), threads, [&](size_t i) {
+        if (!block(*blocks[i].first, blocks[i].second)) good = false;
+      });
+
+      return good;
+    }
+
+#ifdef ASAR_POSIX
+    // Recreates the archive under destination. Directories and links (as
+    // relative symbolic links) are created up front, then file contents
+    // (large files split into chunks) are handed out to the worker threads
+    // through a shared cursor and copied archive-to-file inside the kernel;
+    // unpacked entries are copied from their files. Returns false if
+    // anything failed.
+    bool extractAll(const std::string & destination, unsigned threads = std::thread::hardware_concurrency()) const {
+      static constexpr uint64_t chunk = 16 << 20;
+
+      struct Task {
+        const Entry * entry;
+        uint64_t from; // offset within the entry
+        uint64_t size;
+        bool whole;
+      };
+
+      materialize();
+      if (mkdir(destination.c_str(), 0755) != 0 && errno != EEXIST) return false;
+
+      std::vector<Task> tasks;
+      std::atomic<bool> ok{true};
+
+      for (auto & e : entries) {
+        std::string_view path = key(e);
+        if (!safe(path)) { ok = false; continue; }
+
+        std::string target = destination + '/' + std::string(path);
+        if (e.isDirectory()) {
+          if (mkdir(target.c_str(), 0755) != 0 && errno != EEXIST) ok = false;
+          continue;
+        }
+        if (e.isLink()) {
+          if (!e.offset) continue; // dangling
+          std::string relative;
+          for (char c : path)
+            if (c == '/') relative += "../";
+          relative += key(entries[e.offset - 1]);
+          ::unlink(target.c_str());
+          if (symlink(relative.c_str(), target.c_str()) != 0) ok = false;
+          continue;
+        }
+        if (!inside(e)) { ok = false; continue; }
+
+        if (e.size <= chunk) { tasks.push_back({&e, 0, e.size, true}); continue; }
+
+        // Large files are sized once here so that chunks can land in any order.
+        int out = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, e.flags & Executable ? 0755 : 0644);
+        if (out < 0 || ftruncate(out, e.size) != 0) ok = false;
+        if (out >= 0) ::close(out);
+        for (uint64_t from = 0; from < e.size; from += chunk)
+          tasks.push_back({&e, from, std::min(chunk, e.size - from), false});
+      }
+
+      parallel(tasks.size(), threads, [&](size_t i) {
+        const Task & t = tasks[i];
+        std::string target = destination + '/' + std::string(key(*t.entry));
+
+        int flags = t.whole ? O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC : O_WRONLY | O_CLOEXEC;
+        Source source = this->source(*t.entry);
+        if (source.in == -1) { ok = false; return; }
+
+        int out = ::open(target.c_str(), flags, t.entry->flags & Executable ? 0755 : 0644);
+        if (out < 0) { ok = false; return; }
+        if (!copy(source.in, source.base + t.from, out, t.from, t.size)) ok = false;
+        ::close(out);
+      });
+
+      return ok;
+    }
+#endif
+
   protected:
-    json::JSON header;
     std::string filename;
-    int offset;
-  
-    json::JSON * resolve(std::string path) {
-      auto * address = &header.at("files"); 
-      int e = path.find('/');
-      
-      while (e != std::string::npos) {
-        std::string i = path.substr(0, e);
-        path.erase(path.begin(), path.begin() + e + 1);
-        e = path.find('/');
 
-        if (i.empty()) continue;
-        if (i.find_last_of(".") != std::string::npos) address = &address->at(i); // is_file
-        else { address = &address->at(i); address = &address->at("files"); } // is_directory
+    void load(const std::string & _filename, const std::string & index, int shared) {
+      filename = _filename;
+
+      fd = openFile(filename);
+      if (fd < 0) return;
+
+#ifdef ASAR_POSIX
+      struct stat st;
+      if (fstat(fd, &st) != 0) return;
+
+      length = st.st_size;
+      stamp.mtime = uint64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+      stamp.inode = st.st_ino;
+#else
+      std::ifstream & in = stream(fd)->in;
+      if (!in.seekg(0, std::ios::end) || in.tellg() < 0) return;
+      length = uint64_t(in.tellg());
+#endif
+      stamp.size = length;
+
+      parse(index, shared);
+    }
+
+    // The rest of loading, the same for a file and for bytes in memory.
+    void parse(const std::string & index, int shared) {
+      if (length < 16) return;
+
+      // Pickle framing: [4][header pickle size][payload size][string size]
+      // followed by the JSON string; file data starts after the pickle.
+      uint8_t prefix[16];
+      if (!readAt(prefix, 16, 0)) return;
+
+      uint64_t pickle = le32(prefix + 4), size = le32(prefix + 12);
+      if (le32(prefix) != 4 || 16 + size > 8 + pickle || 8 + pickle > length) return;
+
+      // Mapping is an optimization (zero-copy view()); everything else also
+      // works through pread(), e.g. when the archive exceeds the address space.
+#ifdef ASAR_POSIX
+      if (!mapping && length <= std::numeric_limits<size_t>::max()) {
+        void * address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (address != MAP_FAILED) mapping = (const char *)address;
+      }
+#endif
+
+      offset = 8 + pickle;
+
+      // An archive updated in place ends in a trailer pointing at its newest
+      // header; the one at the front still describes the original contents.
+      uint8_t tail[32];
+      uint64_t at, n;
+      bool committed = length >= offset + 32 && readAt(tail, 32, length - 32) && trailer(tail, offset, length - 32, at, n);
+      if (committed) {
+        headerAt = at;
+        size = n;
       }
+      headerSize = size;
 
-      address = &address->at(path.substr(0));
-      return address;
+      std::string text;
+      const char * header = mapping ? mapping + headerAt : nullptr;
+      if (!mapping) {
+        text.resize(std::min<uint64_t>(size, 4096));
+        if (!readAt(&text[0], text.size(), headerAt)) return;
+        header = text.data();
+      }
+
+      stamp.offset = offset;
+      stamp.fingerprint = hash(std::string_view(header, std::min<uint64_t>(size, 4096)));
+
+      // Otherwise updates may have committed before one was interrupted,
+      // see recover(); that needs where the data of the front header ends.
+      uint64_t used = 0;
+      if (lazy) {
+        if (!browse(committed ? nullptr : &used)) return;
+        if (!committed && recover(used)) browse(nullptr);
+        return;
+      }
+
+      if (!(shared >= 0 && mapIndex(shared)) && (index.empty() || !loadIndex(index))) {
+        if (!build()) return;
+        if (!committed) {
+          for (const Entry & e : entries)
+            if (!(e.flags & (Directory | Unpacked | Link))) used = std::max(used, e.offset + e.size);
+          if (recover(used) && !build()) return;
+        }
+
+        if (!index.empty()) saveIndex(index);
+      }
+
+      checked.reset(new std::atomic<uint8_t>[digests.size() / 32]());
     }
-  };
+
+    // Parses the header in use into the flat index.
+    bool build() {
+      std::string text;
+      const char * header = mapping ? mapping + headerAt : nullptr;
+      if (!mapping) {
+        text.resize(headerSize);
+        if (!readAt(&text[0], headerSize, headerAt)) return false;
+        header = text.data();
+      }
+
+      built = Storage();
+      Parser parser(header, header + headerSize, built);
+      if (!parser.parse()) built = Storage();
+      finish();
+      return true;
+    }
+
+    // Lazy mode: keeps the header in use and locates its top-level "files"
+    // object, noting in used where the data of its entries ends, if set.
+    bool browse(uint64_t * used) {
+      if (mapping) headerBegin = mapping + headerAt;
+      else {
+        headerText.resize(headerSize);
+        if (!readAt(&headerText[0], headerSize, headerAt)) return false;
+        headerBegin = headerText.data();
+      }
+      headerEnd = headerBegin + headerSize;
+
+      Storage top;
+      Parser::Ranges ranges;
+      Parser parser(headerBegin, headerEnd, top, &ranges);
+      parser.extent = used;
+      parser.listed = &listings;
+      root.reset(new Subtree{});
+      if (parser.parse() && !ranges.empty()) {
+        root->begin = ranges.front().first;
+        root->end = ranges.front().second;
+      }
+      return true;
+    }
+
+    // Without a trailer at the end, bytes past used (where the data of the
+    // front header ends) are left over from interrupted updates. Among them,
+    // the last complete trailer ends the newest update that committed: its
+    // header becomes the one in use and the rest is leftovers.
+    bool recover(uint64_t used) {
+      used += offset;
+
+      // Backwards in windows that overlap by less than a trailer.
+      std::string window;
+      for (uint64_t end = length; end >= used + 32;) {
+        uint64_t start = end - std::min<uint64_t>(end - used, 1 << 20), at, size;
+        window.resize(end - start);
+        if (!readAt(&window[0], window.size(), start)) return false;
+
+        for (size_t k = window.size() - 8; (k = window.rfind(trailerMagic, k)) != std::string::npos && k >= 24; k--)
+          if (trailer((const uint8_t *)&window[k - 24], offset, start + k - 24, at, size)) {
+            headerAt = at;
+            headerSize = size;
+            leftovers = start + k + 8;
+            return true;
+          }
+
+        if (start == used) break;
+        end = start + 31;
+      }
+      return false;
+    }
+
+    uint64_t offset = 0; // start of the file data
+    uint64_t headerAt = 16, headerSize = 0; // the header in use, see trailer()
+    uint64_t leftovers = 0; // where bytes of an interrupted update begin, see recover()
+
+    static constexpr int inMemory = -2;
+    int fd = -1; // inMemory when mapping is the caller's, see Memory
+    const char * mapping = nullptr;
+    uint64_t length = 0;
+
+    static constexpr uint64_t le32(const uint8_t * p) {
+      return uint64_t(p[0]) | uint64_t(p[1]) << 8 | uint64_t(p[2]) << 16 | uint64_t(p[3]) << 24;
+    }
+
+    static constexpr uint64_t le64(const uint8_t * p) {
+      return le32(p) | le32(p + 4) << 32;
+    }
+
+#ifdef ASAR_POSIX
+    static int openFile(const std::string & path) {
+      return ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    static void closeFile(int in) {
+      ::close(in);
+    }
+
+    static ssize_t readFile(int in, void * out, size_t size, uint64_t from) {
+      return pread(in, out, size, from);
+    }
+#else
+    // Without POSIX, descriptors are slots in a process-wide table of
+    // streams, and a positional read is a seek and a read under the
+    // stream's lock. A slot is only freed once nothing reads from it.
+    struct Stream {
+      std::mutex mutex;
+      std::ifstream in;
+    };
+
+    struct Streams {
+      std::mutex mutex;
+      std::vector<std::unique_ptr<Stream>> slots; // null when free
+    };
+
+    static Streams & streams() {
+      static Streams table;
+      return table;
+    }
+
+    static Stream * stream(int in) {
+      Streams & table = streams();
+      std::lock_guard<std::mutex> lock(table.mutex);
+      return in >= 0 && size_t(in) < table.slots.size() ? table.slots[in].get() : nullptr;
+    }
+
+    static int openFile(const std::string & path) {
+      std::unique_ptr<Stream> s(new Stream);
+      s->in.open(path, std::ios::binary);
+      if (!s->in) return -1;
+
+      Streams & table = streams();
+      std::lock_guard<std::mutex> lock(table.mutex);
+      auto slot = std::find(table.slots.begin(), table.slots.end(), nullptr);
+      if (slot == table.slots.end()) slot = table.slots.insert(slot, nullptr);
+      *slot = std::move(s);
+      return int(slot - table.slots.begin());
+    }
+
+    static void closeFile(int in) {
+      Streams & table = streams();
+      std::lock_guard<std::mutex> lock(table.mutex);
+      if (in >= 0 && size_t(in) < table.slots.size()) table.slots[in].reset();
+    }
+
+    static ssize_t readFile(int in, void * out, size_t size, uint64_t from) {
+      Stream * s = stream(in);
+      if (!s) return -1;
+
+      std::lock_guard<std::mutex> lock(s->mutex);
+      s->in.clear();
+      if (!s->in.seekg(std::streamoff(from))) return -1;
+      s->in.read((char *)out, std::streamsize(size));
+      return ssize_t(s->in.gcount());
+    }
+#endif
+
+    bool readAt(void * out, uint64_t size, uint64_t from) const {
+      return readAt(fd, out, size, from);
+    }
+
+    bool readAt(int in, void * out, uint64_t size, uint64_t from) const {
+      if (in == inMemory) {
+        if (from > length || size > length - from) return false;
+        std::memcpy(out, mapping + from, size);
+        count(Bytes, size);
+        return true;
+      }
+
+      for (char * p = (char *)out; size > 0;) {
+        ssize_t n = readFile(in, p, std::min<uint64_t>(size, 1 << 30), from);
+        count(Reads);
+        if (n <= 0) return false;
+        count(Bytes, n);
+        p += n; from += n; size -= n;
+      }
+      return true;
+    }
+
+    // Overflow-safe check that an entry's bytes lie inside the archive.
+    // Unpacked entries pass; reading their files checks the size.
+    bool inside(const Entry & e) const {
+      if (e.isUnpacked()) return true;
+      return offset <= length && e.offset <= length - offset && e.size <= length - offset - e.offset;
+    }
+
+    // Where an entry's bytes start: in the archive, or at 0 in its unpacked
+    // file, whose descriptor file keeps open. in is -1 if that cannot be
+    // opened.
+    struct Source {
+      int in;
+      uint64_t base;
+      std::shared_ptr<const int> file;
+    };
+
+    Source source(const Entry & e) const {
+      if (!e.isUnpacked()) return {fd, offset + e.offset, nullptr};
+      std::shared_ptr<const int> file = unpacked(e);
+      return {file ? *file : -1, 0, std::move(file)};
+    }
+
+    // Whether view() can hand out e: a file inside the mapped archive whose
+    // bytes pass verification.
+    bool mapped(const Entry & e) const {
+      return mapping && !e.isDirectory() && !e.isUnpacked() && inside(e) && verified(e, 0, e.size);
+    }
+
+    // Reads size bytes of e, starting from within the entry.
+    bool fetch(const Entry & e, void * out, uint64_t size, uint64_t from) const {
+      Source source = this->source(e);
+      return source.in != -1 && readAt(source.in, out, size, source.base + from);
+    }
+
+    // Unpacked entries are opened on first use and kept in a small LRU pool.
+    // Handles are shared, so eviction never closes a descriptor another
+    // thread is still reading from.
+    struct Pool {
+      static constexpr size_t capacity = 64;
+
+      std::mutex mutex;
+      std::list<std::pair<size_t, std::shared_ptr<const int>>> order; // by entry index, most recent first
+      std::unordered_map<size_t, decltype(order)::iterator> index;
+    };
+    mutable Pool pool;
+
+    std::shared_ptr<const int> unpacked(const Entry & e) const {
+      size_t i = &e - entries.data;
+      {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        auto it = pool.index.find(i);
+        if (it != pool.index.end()) {
+          pool.order.splice(pool.order.begin(), pool.order, it->second);
+          return it->second->second;
+        }
+      }
+
+      std::string_view path = key(e);
+      if (fd == inMemory || !safe(path)) return nullptr;
+
+      std::string file = filename + ".unpacked/" + std::string(path);
+      int in = openFile(file);
+      if (in < 0) return nullptr;
+      std::shared_ptr<const int> handle(new int(in), [](const int * p) { closeFile(*p); delete p; });
+
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      auto it = pool.index.find(i);
+      if (it != pool.index.end()) return it->second->second;
+
+      pool.order.emplace_front(i, handle);
+      pool.index[i] = pool.order.begin();
+      if (pool.order.size() > Pool::capacity) {
+        pool.index.erase(pool.order.back().first);
+        pool.order.pop_back();
+      }
+      return handle;
+    }
+
+    bool load(const Entry & e, std::string & out) const {
+      out.clear();
+      if (!inside(e)) return false;
+
+      if (mapping && !e.isUnpacked()) { out.assign(mapping + offset + e.offset, e.size); count(Bytes, e.size); }
+      else {
+        out.resize(e.size);
+        if (!fetch(e, &out[0], e.size, 0)) { out.clear(); return false; }
+      }
+
+      if (!verified(e, 0, e.size)) { out.clear(); return false; }
+      return true;
+    }
+
+    bool slice(const Entry & e, uint64_t from, uint64_t size, std::string & out) const {
+      out.clear();
+      if (e.isDirectory() || !inside(e) || from > e.size) return false;
+      size = std::min(size, e.size - from);
+
+      if (mapping && !e.isUnpacked()) { out.assign(mapping + offset + e.offset + from, size); count(Bytes, size); }
+      else {
+        out.resize(size);
+        if (size && !fetch(e, &out[0], size, from)) { out.clear(); return false; }
+      }
+
+      if (!verified(e, from, size)) { out.clear(); return false; }
+      return true;
+    }
+
+#ifdef ASAR_POSIX
+    bool send(const Entry & e, int out, uint64_t from, uint64_t size) const {
+      if (e.isDirectory() || !inside(e) || from > e.size) return false;
+      size = std::min(size, e.size - from);
+      if (!verified(e, from, size)) return false;
+
+      Source source = this->source(e);
+      if (source.in == -1) return false;
+      from += source.base;
+
+      // Non-blocking descriptors are waited on rather than given up on.
+      auto writable = [&] {
+        if (errno == EINTR) return true;
+        pollfd p{out, POLLOUT, 0};
+        return errno == EAGAIN && poll(&p, 1, -1) > 0;
+      };
+
+#ifdef __linux__
+      if (source.in != inMemory) {
+        off_t position = from;
+        while (size > 0) {
+          ssize_t n = sendfile(out, source.in, &position, std::min<uint64_t>(size, 1 << 30));
+          if (n < 0 && writable()) continue;
+          if (n == 0) return false;
+          if (n < 0) break;
+          count(Bytes, n);
+          size -= n;
+        }
+        if (size == 0) return true;
+        if (errno != EINVAL && errno != ENOSYS) return false; // out cannot take sendfile()
+        from = position;
+      }
+#endif
+      const char * mapped = source.in == fd ? mapping : nullptr;
+      std::string buffer(mapped ? 0 : std::min<uint64_t>(size, 1 << 20), '\0');
+      while (size > 0) {
+        const char * data = mapped ? mapped + from : buffer.data();
+        size_t want = mapped ? std::min<uint64_t>(size, 1 << 30) : std::min<uint64_t>(size, buffer.size());
+        if (!mapped && !readAt(source.in, &buffer[0], want, from)) return false;
+
+        for (size_t done = 0; done < want;) {
+          ssize_t n = ::write(out, data + done, want - done);
+          if (n < 0 && writable()) continue;
+          if (n <= 0) return false;
+          count(Bytes, n);
+          done += n;
+        }
+        from += want; size -= want;
+      }
+      return true;
+    }
+#endif
+
+    // Flat index: every file and directory keyed by its full normalized path
+    // ("assets/image.png"), sorted by path and open-addressed so a lookup is
+    // one hash and a probe. Records refer to each other by offset only, so
+    // the tables can point into built below or into a mapped index file.
+    // They are mutable only so that a lazy Asar can fill them in once, under
+    // std::call_once, from materialize().
+    mutable Table<Entry> entries;
+    mutable Table<uint32_t> slots; // entry index + 1, 0 marks an empty slot
+    mutable Table<char> names;
+    mutable Table<Integrity> integrities;
+    mutable Table<uint8_t> digests; // 32 bytes per block
+
+    struct Storage {
+      std::vector<Entry> entries;
+      std::vector<uint32_t> slots;
+      std::string names;
+      std::vector<Integrity> integrities;
+      std::vector<uint8_t> digests;
+    };
+    mutable Storage built;
+
+    // Lazy mode: one node per directory, holding its direct children (full
+    // paths, hashed like the flat index) once expanded. Entries found this
+    // way carry no integrity data and their name offsets are local to the
+    // node, so anything beyond lookup goes through materialize() first.
+    struct Subtree {
+      const char * begin = nullptr; // the directory's "files" object
+      const char * end = nullptr;
+      std::string path;
+      std::once_flag once;
+      Storage storage;
+      std::vector<std::unique_ptr<Subtree>> children; // by entry, directories only
+    };
+
+    bool lazy = false;
+    std::string headerText; // header copy, when it cannot be read from the mapping
+    const char * headerBegin = nullptr;
+    const char * headerEnd = nullptr;
+    std::unique_ptr<Subtree> root;
+    std::vector<std::pair<const char *, const char *>> listings; // every nested "files" object, measured while opening
+    mutable std::once_flag materialized;
+    mutable std::atomic<bool> complete{false};
+    mutable bool linkedDirectories = false; // any link to a directory in the flat index
+
+    static const Entry * probe(Table<Entry> entries, Table<uint32_t> slots, Table<char> names, std::string_view path) {
+      if (slots.empty()) return nullptr;
+
+      size_t mask = slots.size() - 1;
+      for (size_t s = hash(path) & mask; slots[s]; s = (s + 1) & mask) {
+        const Entry & e = entries[slots[s] - 1];
+        if (std::string_view(names.data + e.name, e.length) == path) return &e;
+      }
+
+      return nullptr;
+    }
+
+    // Probes the flat index for head + tail, hashed as h, without joining
+    // the two.
+    const Entry * probe(uint64_t h, std::string_view head, std::string_view tail) const {
+      if (slots.empty()) return nullptr;
+
+      size_t mask = slots.size() - 1;
+      for (size_t s = h & mask; slots[s]; s = (s + 1) & mask) {
+        const Entry & e = entries[slots[s] - 1];
+        std::string_view name(names.data + e.name, e.length);
+        if (name.size() == head.size() + tail.size() && name.substr(0, head.size()) == head && name.substr(head.size()) == tail) return &e;
+      }
+
+      return nullptr;
+    }
+
+    // Lookup in the flat index that follows links: a link resolves to its
+    // target, and a miss retries through a link to a directory along the
+    // path. Only archives with such a link walk the path on a miss.
+    const Entry * lookup(std::string_view path) const {
+      auto next = [this](const Entry & link, unsigned) { return link.offset ? &entries[link.offset - 1] : nullptr; };
+      const Entry * e = probe(entries, slots, names, path);
+      if (e) return e->isLink() ? next(*e, 0) : e;
+      return linkedDirectories ? through({}, path, next) : nullptr;
+    }
+
+    static constexpr unsigned maxHops = 40; // like SYMLOOP_MAX
+
+    // Resolves head + tail, where head is empty or a directory's path and
+    // tail is the rest (starting with '/' after a head). next(link, hops)
+    // gives the entry a link leads to.
+    template <typename Next>
+    const Entry * follow(std::string_view head, std::string_view tail, const Next & next, unsigned hops = 0) const {
+      if (hops > maxHops) return nullptr;
+
+      uint64_t h = hash(head);
+      for (unsigned char c : tail) h = hash(h, c);
+      const Entry * e = probe(h, head, tail);
+      if (e) return e->isLink() ? next(*e, hops) : e;
+      return through(head, tail, next, hops);
+    }
+
+    // The miss half of follow(): finds the first link along the path and
+    // carries on from its target. The prefixes are hashed as they are
+    // scanned, and a head has no links above it.
+    template <typename Next>
+    const Entry * through(std::string_view head, std::string_view tail, const Next & next, unsigned hops = 0) const {
+      uint64_t h = hash(head);
+      for (size_t i = 0; i < tail.size(); h = hash(h, tail[i++])) {
+        if (!i || tail[i] != '/') continue;
+
+        const Entry * dir = probe(h, head, tail.substr(0, i));
+        if (!dir) return nullptr;
+        if (!dir->isLink()) continue;
+
+        dir = next(*dir, hops);
+        if (!dir || !dir->isDirectory()) return nullptr;
+        return follow(key(*dir), tail.substr(i), next, hops + 1);
+      }
+
+      return nullptr;
+    }
+
+    void expand(Subtree & dir) const {
+      std::call_once(dir.once, [&] {
+        Parser::Ranges ranges;
+        Parser parser(dir.begin, dir.end, dir.storage, &ranges, dir.path);
+        parser.known = &listings;
+        if (!dir.begin || !parser.files()) dir.storage = Storage();
+        rehash(dir.storage);
+
+        ranges.resize(dir.storage.entries.size());
+        dir.children.resize(dir.storage.entries.size());
+        for (size_t i = 0; i < ranges.size(); i++) {
+          if (!ranges[i].first) continue;
+          const Entry & e = dir.storage.entries[i];
+          dir.children[i].reset(new Subtree{});
+          dir.children[i]->begin = ranges[i].first;
+          dir.children[i]->end = ranges[i].second;
+          dir.children[i]->path.assign(dir.storage.names, e.name, e.length);
+        }
+      });
+    }
+
+    const Entry * descend(std::string_view path) const {
+      Subtree * dir = root.get();
+
+      for (size_t at = 0; dir;) {
+        expand(*dir);
+
+        size_t slash = path.find('/', at);
+        const Storage & s = dir->storage;
+        const Entry * e = probe(table(s.entries), table(s.slots), Table<char>{s.names.data(), s.names.size()}, path.substr(0, slash));
+
+        // Links and unpacked files need the whole index (targets, full names).
+        if (e && (e->isLink() || (slash == std::string_view::npos && e->isUnpacked()))) {
+          std::string full(path);
+          materialize();
+          return lookup(full);
+        }
+        if (!e || slash == std::string_view::npos) return e;
+
+        dir = dir->children[e - s.entries.data()].get();
+        at = slash + 1;
+      }
+
+      return nullptr;
+    }
+
+    // Parses the whole header into the flat index (lazy mode only; a no-op
+    // otherwise). Lookups switch over to it once it is published.
+    void materialize() const {
+      if (!lazy) return;
+
+      std::call_once(materialized, [this] {
+        Parser parser(headerBegin, headerEnd, built);
+        if (!headerBegin || !parser.parse()) built = Storage();
+        finish();
+        checked.reset(new std::atomic<uint8_t>[digests.size() / 32]());
+        complete.store(true, std::memory_order_release);
+      });
+    }
+
+    // Identifies the archive an index file was built from.
+    struct Stamp {
+      uint64_t size;
+      uint64_t mtime; // nanoseconds
+      uint64_t inode;
+      uint64_t offset;
+      uint64_t fingerprint; // hash of the first 4 KiB of the header the end points at
+    } stamp{};
+
+    struct IndexHeader {
+      char magic[8];
+      Stamp stamp;
+      uint64_t headerAt, headerSize;
+      uint64_t entries, slots, names, integrities, digests;
+    };
+
+    const char * indexMapping = nullptr;
+    size_t indexLength = 0;
+
+    // FNV-1a, also usable a byte at a time.
+    static constexpr uint64_t hashBasis = 14695981039346656037ull;
+
+    static constexpr uint64_t hash(uint64_t h, unsigned char c) {
+      return (h ^ c) * 1099511628211ull;
+    }
+
+    static constexpr uint64_t hash(std::string_view key) {
+      uint64_t h = hashBasis;
+      for (unsigned char c : key) h = hash(h, c);
+      return h;
+    }
+
+    // Strips leading/trailing separators; only paths with repeated separators
+    // need a rewrite, and that reuses a per-thread buffer.
+    static std::string_view normalize(std::string_view path) {
+      while (!path.empty() && path.front() == '/') path.remove_prefix(1);
+      while (!path.empty() && path.back() == '/') path.remove_suffix(1);
+      if (path.find("//") == std::string_view::npos) return path;
+
+      thread_local std::string buffer;
+      buffer.clear();
+      for (char c : path)
+        if (c != '/' || buffer.back() != '/') buffer += c;
+      return buffer;
+    }
+
+    std::string_view key(const Entry & e) const {
+      return std::string_view(names.data + e.name, e.length);
+    }
+
+    // resolve() without the counters, for lookups made on the caller's
+    // behalf (glob(), prefetch(), verify()): only public reads count.
+    const Entry * locate(std::string_view path) const {
+      path = normalize(path);
+      return lazy && !complete.load(std::memory_order_acquire) ? descend(path) : lookup(path);
+    }
+
+    // Entries under dir: those starting with "dir/", which sort between
+    // "dir/" and "dir0" ('0' follows '/').
+    std::pair<const Entry *, const Entry *> subtree(std::string_view dir) const {
+      materialize();
+      std::string prefix(normalize(dir));
+      if (prefix.empty()) return {entries.begin(), entries.end()};
+
+      prefix += '/';
+      auto less = [this](const Entry & e, const std::string & p) { return key(e) < p; };
+      const Entry * first = std::lower_bound(entries.begin(), entries.end(), prefix, less);
+      return {first, after(std::string_view(prefix).substr(0, prefix.size() - 1), first, entries.end())};
+    }
+
+    // First entry in [first, last) past every descendant of dir.
+    const Entry * after(std::string_view dir, const Entry * first, const Entry * last) const {
+      std::string bound(dir);
+      bound += '0';
+      return std::lower_bound(first, last, bound, [this](const Entry & e, const std::string & b) { return key(e) < b; });
+    }
+
+    static bool match(std::string_view pattern, std::string_view path) {
+      while (!pattern.empty()) {
+        if (pattern.substr(0, 2) == "**") {
+          if (pattern.size() == 2) return true;
+          if (pattern[2] != '/') { pattern.remove_prefix(1); continue; } // "**x" acts as "*x"
+
+          pattern.remove_prefix(3);
+          for (;;) {
+            if (match(pattern, path)) return true;
+            size_t slash = path.find('/');
+            if (slash == std::string_view::npos) return false;
+            path.remove_prefix(slash + 1);
+          }
+        }
+
+        if (pattern.front() == '*') {
+          pattern.remove_prefix(1);
+          for (size_t i = 0;; i++) {
+            if (match(pattern, path.substr(i))) return true;
+            if (i == path.size() || path[i] == '/') return false;
+          }
+        }
+
+        if (path.empty() || (pattern.front() == '?' ? path.front() == '/' : pattern.front() != path.front())) return false;
+        pattern.remove_prefix(1);
+        path.remove_prefix(1);
+      }
+
+      return path.empty();
+    }
+
+    mutable std::unique_ptr<std::atomic<uint8_t>[]> checked; // per block: 0 unknown, 1 good, 2 bad
+    bool verifying = false;
+
+    struct Profile {
+      std::string file;
+      std::mutex mutex;
+      std::vector<std::string> order;
+      std::unordered_set<std::string> seen;
+    };
+
+    std::unique_ptr<Profile> profile;
+    std::thread prefetcher;
+    std::atomic<bool> stopping{false};
+
+#ifdef ASAR_POSIX
+    static bool slurp(const std::string & file, std::string & out) {
+      int in = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+      if (in < 0) return false;
+
+      char buffer[16384];
+      ssize_t n;
+      while ((n = ::read(in, buffer, sizeof buffer)) > 0) out.append(buffer, n);
+      ::close(in);
+      return n == 0;
+    }
+
+    // Writes file atomically: fill(fd) writes a temporary file next to it,
+    // which is renamed over file if fill() and close() succeed and removed
+    // otherwise.
+    template <typename F>
+    static bool replace(const std::string & file, F fill) {
+      std::string temporary = file + ".tmp" + std::to_string(getpid());
+      int out = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (out < 0) return false;
+
+      bool ok = fill(out);
+      ok = ::close(out) == 0 && ok;
+      if (ok) ok = ::rename(temporary.c_str(), file.c_str()) == 0;
+      if (!ok) ::unlink(temporary.c_str());
+      return ok;
+    }
+#endif
+
+    // Pickle framing for a header of size bytes, padded to 4:
+    // [4][header pickle size][payload size][string size]
+    static void pickle(uint32_t size, uint8_t out[16]) {
+      uint32_t padded = (size + 3) & ~3u;
+      uint32_t fields[4] = {4, padded + 8, padded + 4, size};
+      for (int f = 0; f < 4; f++)
+        for (int b = 0; b < 4; b++) out[f * 4 + b] = uint8_t(fields[f] >> (b * 8));
+    }
+
+    // Trailer of an archive updated in place (see Updater), the last 32
+    // bytes of the file: [u64 header position][u64 header size][u64 check]
+    // ["ASARTRL1"], where check is hash() of the first 16 bytes.
+    static constexpr char trailerMagic[9] = "ASARTRL1";
+
+    static constexpr uint64_t trailerCheck(const uint8_t * t) {
+      uint64_t h = hashBasis;
+      for (int b = 0; b < 16; b++) h = hash(h, t[b]);
+      return h;
+    }
+
+    static void trailer(uint64_t at, uint64_t size, uint8_t out[32]) {
+      for (int b = 0; b < 8; b++) { out[b] = uint8_t(at >> (b * 8)); out[8 + b] = uint8_t(size >> (b * 8)); }
+      uint64_t check = trailerCheck(out);
+      for (int b = 0; b < 8; b++) out[16 + b] = uint8_t(check >> (b * 8));
+      std::memcpy(out + 24, trailerMagic, 8);
+    }
+
+    // Whether t is a trailer whose header lies within [first, end).
+    // Usable in constant expressions, for Embedded.
+    static constexpr bool trailer(const uint8_t * t, uint64_t first, uint64_t end, uint64_t & at, uint64_t & size) {
+      for (int b = 0; b < 8; b++)
+        if (t[24 + b] != uint8_t(trailerMagic[b])) return false;
+      if (le64(t + 16) != trailerCheck(t)) return false;
+      at = le64(t);
+      size = le64(t + 8);
+      return at >= first && at <= end && size <= end - at;
+    }
+
+    void note(std::string_view path) const {
+      if (!profile) return;
+
+      path = normalize(path);
+      if (path.find('\n') != std::string_view::npos) return;
+
+      std::lock_guard<std::mutex> lock(profile->mutex);
+      if (profile->seen.emplace(path).second) profile->order.emplace_back(path);
+    }
+
+#ifdef ASAR_POSIX
+    // Works through the ranges in windows: recorded order decides which
+    // window goes first, and within one the ranges are sorted and merged
+    // across small gaps, so the kernel sees few, large requests.
+    void advise(std::vector<std::pair<uint64_t, uint64_t>> & ranges) {
+      static constexpr size_t window = 64;
+      static constexpr uint64_t gap = 64 * 1024;
+      uint64_t page = sysconf(_SC_PAGESIZE);
+
+      for (size_t first = 0; first < ranges.size() && !stopping; first += window) {
+        auto begin = ranges.begin() + first, end = ranges.begin() + std::min(ranges.size(), first + window);
+        std::sort(begin, end);
+
+        for (auto i = begin; i != end && !stopping;) {
+          uint64_t from = i->first, to = i->first + i->second;
+          for (++i; i != end && i->first <= to + gap; ++i) to = std::max(to, i->first + i->second);
+
+          if (mapping) {
+            uint64_t aligned = from & ~(page - 1);
+            madvise((void *)(mapping + aligned), to - aligned, MADV_WILLNEED);
+          } else {
+#ifdef POSIX_FADV_WILLNEED
+            posix_fadvise(fd, from, to - from, POSIX_FADV_WILLNEED);
+#endif
+          }
+        }
+      }
+    }
+#endif
+
+    enum Metric : size_t { Hits, Misses, Bytes, Reads, CacheHits, Metrics };
+    enum Timing : size_t { Resolving, Unpacking, Timings };
+
+#ifdef ASAR_STATS
+    // One block per thread and Asar, written by its thread only (plain
+    // relaxed load/store pairs, no contended cache lines) and summed by
+    // stats().
+    struct Meter {
+      std::atomic<uint64_t> counts[Metrics] = {};
+      std::atomic<uint64_t> buckets[Timings][Histogram::size] = {};
+      std::atomic<uint64_t> nanoseconds[Timings] = {};
+    };
+
+    struct Meters {
+      std::mutex mutex;
+      std::deque<Meter> threads;
+      const uint64_t serial = [] { static std::atomic<uint64_t> next{1}; return next++; }();
+      const std::shared_ptr<const bool> alive = std::make_shared<const bool>(true); // expires with the Asar
+    };
+    mutable Meters meters;
+
+    Meter & meter() const {
+      thread_local uint64_t owner = 0;
+      thread_local Meter * last = nullptr;
+      if (owner == meters.serial) return *last;
+
+      // A thread's blocks by Asar. Serials are never reused, so entries of
+      // destroyed Asars are never looked up again; they are swept out
+      // whenever the map has doubled, so a thread that outlives many Asars
+      // keeps about as many entries as it has live ones.
+      struct Block {
+        Meter * meter = nullptr;
+        std::weak_ptr<const bool> alive;
+      };
+      thread_local std::unordered_map<uint64_t, Block> mine;
+      thread_local size_t sweep = 16;
+
+      Block & block = mine[meters.serial];
+      if (!block.meter) {
+        {
+          std::lock_guard<std::mutex> lock(meters.mutex);
+          block.meter = &meters.threads.emplace_back();
+        }
+        block.alive = meters.alive;
+
+        if (mine.size() >= sweep) {
+          for (auto i = mine.begin(); i != mine.end();) i = i->second.alive.expired() ? mine.erase(i) : std::next(i);
+          sweep = std::max<size_t>(16, mine.size() * 2);
+        }
+      }
+
+      owner = meters.serial;
+      return *(last = block.meter);
+    }
+
+    static void add(std::atomic<uint64_t> & counter, uint64_t n) {
+      counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+#endif
+
+    void count(Metric metric, uint64_t n = 1) const {
+#ifdef ASAR_STATS
+      add(meter().counts[metric], n);
+#else
+      (void)metric; (void)n;
+#endif
+    }
+
+    // Records the lifetime of the enclosing scope into a latency histogram.
+    class Timer {
+      public:
+#ifdef ASAR_STATS
+        Timer(const Asar & asar, Timing _timing) : meter(asar.meter()), timing(_timing), start(std::chrono::steady_clock::now()) {}
+
+        ~Timer() {
+          uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+#ifdef __GNUC__
+          size_t b = ns ? std::min<size_t>(64 - __builtin_clzll(ns), Histogram::size - 1) : 0;
+#else
+          size_t b = 0;
+          while (b < Histogram::size - 1 && ns >> b) b++;
+#endif
+          add(meter.buckets[timing][b], 1);
+          add(meter.nanoseconds[timing], ns);
+        }
+
+      private:
+        Meter & meter;
+        Timing timing;
+        std::chrono::steady_clock::time_point start;
+#else
+        Timer(const Asar &, Timing) {}
+#endif
+    };
+
+    struct Cache {
+      struct Shard {
+        mutable std::mutex mutex;
+        std::list<std::pair<const Entry *, std::shared_ptr<const std::string>>> order; // most recent first
+        std::unordered_map<const Entry *, decltype(order)::iterator> index;
+        size_t bytes = 0;
+      };
+
+      Cache(size_t bytes, unsigned count) : budget(bytes), share(bytes / count), shards(count) {}
+
+      // Drops the least recently used entry of shard; its mutex is held.
+      void evict(Shard & shard) {
+        auto & last = shard.order.back();
+        shard.bytes -= last.second->size();
+        bytes -= last.second->size();
+        shard.index.erase(last.first);
+        shard.order.pop_back();
+        evictions++;
+      }
+
+      size_t budget, share; // in total, per shard
+      std::vector<Shard> shards;
+      std::atomic<size_t> bytes{0};
+      std::atomic<uint64_t> hits{0}, misses{0}, evictions{0};
+    };
+
+    std::unique_ptr<Cache> cache;
+
+    // Runs task(0..count-1) on up to threads threads (the caller included),
+    // each pulling the next index from a shared cursor.
+    template <typename F>
+    static void parallel(size_t count, unsigned threads, F task) {
+      std::atomic<size_t> cursor{0};
+      auto worker = [&]() {
+        for (size_t i = cursor++; i < count; i = cursor++) task(i);
+      };
+
+      threads = std::max<size_t>(1, std::min<size_t>(threads, count));
+      std::vector<std::thread> pool;
+      for (unsigned i = 1; i < threads; i++) pool.emplace_back(worker);
+      worker();
+      for (auto & t : pool) t.join();
+    }
+
+    // Electron's packer hashes whatever is left when its stream ends, so
+    // an entry that fills its last block carries one more digest, of no
+    // bytes; older packers leave it out. Both counts are accepted.
+    static bool counted(const Entry & e, const Integrity & in) {
+      uint64_t full = e.size / in.blockSize;
+      return in.count == full + 1 || (e.size % in.blockSize == 0 && in.count == std::max<uint64_t>(1, full));
+    }
+
+    bool block(const Entry & e, uint32_t b) const {
+      const Integrity & in = integrities[e.integrity - 1];
+      std::atomic<uint8_t> & state = checked[in.first + b];
+
+      uint8_t known = state.load(std::memory_order_relaxed);
+      if (known) return known == 1;
+
+      uint64_t begin = b * in.blockSize;
+      uint64_t size = begin < e.size ? std::min(in.blockSize, e.size - begin) : 0;
+
+      uint8_t digest[32];
+      if (mapping && !e.isUnpacked()) sha256::digest(mapping + offset + e.offset + begin, size, digest);
+      else {
+        std::string data(size, '\0');
+        if (!fetch(e, &data[0], size, begin)) return false;
+        sha256::digest(data.data(), size, digest);
+      }
+      bool ok = std::memcmp(digest, &digests[size_t(in.first + b) * 32], 32) == 0;
+
+      state.store(ok ? 1 : 2, std::memory_order_relaxed);
+      return ok;
+    }
+
+    // Checks every block overlapping [from, from + size) of e.
+    bool check(const Entry & e, uint64_t from, uint64_t size) const {
+      if (!e.integrity) return true;
+
+      const Integrity & in = integrities[e.integrity - 1];
+      if (!counted(e, in)) return false;
+
+      uint64_t last = (from + (size ? size - 1 : 0)) / in.blockSize;
+      for (uint64_t b = from / in.blockSize; b <= last && b < in.count; b++)
+        if (!block(e, b)) return false;
+
+      // The digest of no bytes after a full last block must match as well.
+      uint64_t full = e.size / in.blockSize;
+      if (e.size && e.size % in.blockSize == 0 && in.count == full + 1 && !block(e, full)) return false;
+
+      return true;
+    }
+
+    bool verified(const Entry & e, uint64_t from, uint64_t size) const {
+      return !verifying || check(e, from, size);
+    }
+
+    // Rejects archive paths that would escape an extraction directory.
+    static bool safe(std::string_view path) {
+      while (!path.empty()) {
+        size_t e = path.find('/');
+        std::string_view part = path.substr(0, e);
+        if (part.empty() || part == "." || part == "..") return false;
+        if (e == std::string_view::npos) break;
+        path.remove_prefix(e + 1);
+      }
+      return true;
+    }
+
+#ifdef ASAR_POSIX
+    // Copies size bytes of in (the archive or an unpacked file) starting at
+    // from into out at to, preferring copy_file_range/sendfile so the data
+    // never passes through user space.
+    bool copy(int in, uint64_t from, int out, uint64_t to, uint64_t size) const {
+#ifdef __linux__
+      loff_t source = from, at = to;
+      while (in != inMemory && size > 0) {
+        ssize_t n = copy_file_range(in, &source, out, &at, size, 0);
+        if (n <= 0) break;
+        size -= n;
+      }
+      if (size == 0) return true;
+      from = source; to = at;
+
+      if (in != inMemory && lseek(out, to, SEEK_SET) == (off_t)to) {
+        off_t position = from;
+        while (size > 0) {
+          ssize_t n = sendfile(out, in, &position, size);
+          if (n <= 0) break;
+          size -= n;
+        }
+        if (size == 0) return true;
+        to += position - from; from = position;
+      }
+#endif
+      const char * mapped = in == fd ? mapping : nullptr;
+      std::string buffer(mapped ? 0 : std::min<uint64_t>(size, 1 << 20), '\0');
+      while (size > 0) {
+        const char * data = mapped ? mapped + from : buffer.data();
+        size_t want = mapped ? size : std::min<uint64_t>(size, buffer.size());
+        if (!mapped && !readAt(in, &buffer[0], want, from)) return false;
+
+        ssize_t n = pwrite(out, data, want, to);
+        if (n <= 0) return false;
+        from += n; to += n; size -= n;
+      }
+      return true;
+    }
+#endif
+
+    // Single-pass parser for the header. It knows only the asar schema
+    // (files, size, offset, unpacked, executable, link, integrity) and
+    // appends straight into the built index; no JSON tree is ever built.
+    // Link targets are appended to names, to be resolved by finish().
+    class Parser {
+      public:
+        using Ranges = std::vector<std::pair<const char *, const char *>>;
+
+        // With deferred set, nested "files" objects are skipped by brace
+        // matching and only their byte ranges are recorded (indexed like
+        // out.entries); integrity data is skipped too.
+        Parser(const char * begin, const char * end, Storage & _out, Ranges * _deferred = nullptr, std::string_view prefix = {})
+          : p(begin), last(end), out(_out), deferred(_deferred), path(prefix) {}
+
+        // When set, the text of each entry's "offset" value (quotes included)
+        // is recorded, indexed like out.entries.
+        Ranges * offsets = nullptr;
+
+        // When set, where everything is in the text: every entry's quoted
+        // name and object and every directory's "files" object (indexed like
+        // out.entries), and the top-level "files" object.
+        struct Spans {
+          std::vector<const char *> keys;
+          Ranges nodes;
+          Ranges listings;
+          std::pair<const char *, const char *> root{};
+        };
+        Spans * spans = nullptr;
+
+        // When set, jump() still reads the "offset", "size" and "unpacked" of
+        // the entries it steps over: where their data ends goes into *extent.
+        uint64_t * extent = nullptr;
+
+        // When set, jump() records the range of every "files" object it
+        // steps over, in text order. A later Parser given them as known
+        // takes a deferred directory's end from there instead of scanning.
+        Ranges * listed = nullptr;
+        const Ranges * known = nullptr;
+
+        bool parse() {
+          if (!consume('{')) return false;
+          if (consume('}')) return true;
+
+          do {
+            std::string_view k;
+            if (!string(k) || !consume(':')) return false;
+            if (k == "files") {
+              ws();
+              const char * begin = p;
+              if (!subtree()) return false;
+              if (spans) spans->root = {begin, p};
+            }
+            else if (!skip()) return false;
+          } while (consume(','));
+
+          return consume('}');
+        }
+
+        // The top-level "files" object: parsed, or only located when deferred.
+        bool subtree() {
+          if (deferred) {
+            ws();
+            const char * begin = p;
+            if (!jump()) return false;
+            deferred->emplace_back(begin, p);
+            return true;
+          }
+          return files();
+        }
+
+        // Parses one "files" object: the children of the prefix directory.
+        bool files() {
+          if (!consume('{')) return false;
+          if (consume('}')) return true;
+
+          do {
+            ws();
+            const char * key = p;
+            std::string_view name;
+            if (!string(name) || !consume(':')) return false;
+
+            size_t mark = path.size();
+            if (mark) path += '/';
+            path += name;
+            if (spans) {
+              spans->keys.resize(out.entries.size() + 1);
+              spans->keys.back() = key;
+            }
+            bool ok = node();
+            path.resize(mark);
+            if (!ok) return false;
+          } while (consume(','));
+
+          return consume('}');
+        }
+
+      private:
+        const char * p;
+        const char * last;
+        Storage & out;
+        Ranges * deferred;
+        std::string path;
+        std::string scratch;
+
+        struct Object { uint64_t offset = 0, size = 0; bool placed = false, unpacked = false; };
+        std::vector<Object> objects; // open in jump(), with extent set
+        std::vector<std::pair<size_t, size_t>> open; // listings open in jump(): depth, index in *listed
+
+        void ws() {
+          while (p < last && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+        }
+
+        bool consume(char c) {
+          ws();
+          if (p < last && *p == c) { p++; return true; }
+          return false;
+        }
+
+        bool literal(std::string_view word) {
+          if (size_t(last - p) < word.size() || std::string_view(p, word.size()) != word) return false;
+          p += word.size();
+          return true;
+        }
+
+        static void utf8(std::string & out, uint32_t c) {
+          if (c < 0x80) out += char(c);
+          else if (c < 0x800) { out += char(0xC0 | c >> 6); out += char(0x80 | (c & 0x3F)); }
+          else if (c < 0x10000) { out += char(0xE0 | c >> 12); out += char(0x80 | (c >> 6 & 0x3F)); out += char(0x80 | (c & 0x3F)); }
+          else { out += char(0xF0 | c >> 18); out += char(0x80 | (c >> 12 & 0x3F)); out += char(0x80 | (c >> 6 & 0x3F)); out += char(0x80 | (c & 0x3F)); }
+        }
+
+        bool hex4(uint32_t & c) {
+          if (last - p < 4) return false;
+          c = 0;
+          for (int i = 0; i < 4; i++, p++) {
+            char h = *p;
+            c <<= 4;
+            if (h >= '0' && h <= '9') c |= h - '0';
+            else if (h >= 'a' && h <= 'f') c |= h - 'a' + 10;
+            else if (h >= 'A' && h <= 'F') c |= h - 'A' + 10;
+            else return false;
+          }
+          return true;
+        }
+
+        // Strings without escapes are returned in place; the rest are decoded
+        // into a reused scratch buffer.
+        bool string(std::string_view & out) {
+          if (!consume('"')) return false;
+
+          const char * begin = p;
+          while (p < last && *p != '"' && *p != '\\') p++;
+          if (p >= last) return false;
+          if (*p == '"') { out = std::string_view(begin, p - begin); p++; return true; }
+
+          scratch.assign(begin, p);
+          while (p < last && *p != '"') {
+            if (*p != '\\') { scratch += *p++; continue; }
+            if (++p >= last) return false;
+            switch (*p++) {
+              case '"' : scratch += '"';  break;
+              case '\\': scratch += '\\'; break;
+              case '/' : scratch += '/';  break;
+              case 'b' : scratch += '\b'; break;
+              case 'f' : scratch += '\f'; break;
+              case 'n' : scratch += '\n'; break;
+              case 'r' : scratch += '\r'; break;
+              case 't' : scratch += '\t'; break;
+              case 'u' : {
+                uint32_t c;
+                if (!hex4(c)) return false;
+                if (c >= 0xD800 && c < 0xDC00 && literal("\\u")) {
+                  uint32_t low;
+                  if (!hex4(low)) return false;
+                  c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                }
+                utf8(scratch, c);
+              } break;
+              default: return false;
+            }
+          }
+          if (p >= last) return false;
+
+          p++;
+          out = scratch;
+          return true;
+        }
+
+        // Sizes are plain numbers, offsets are decimal strings (to survive
+        // JavaScript's 53-bit integers); accept either for both.
+        bool number(uint64_t & out) {
+          ws();
+          bool quoted = p < last && *p == '"';
+          if (quoted) p++;
+
+          const char * begin = p;
+          out = 0;
+          while (p < last && *p >= '0' && *p <= '9') {
+            uint64_t digit = *p++ - '0';
+            if (out > (std::numeric_limits<uint64_t>::max() - digit) / 10) return false;
+            out = out * 10 + digit;
+          }
+          if (p == begin) return false;
+
+          return !quoted || (p < last && *p++ == '"');
+        }
+
+        bool boolean(bool & out) {
+          ws();
+          if (literal("true")) { out = true; return true; }
+          if (literal("false")) { out = false; return true; }
+          return false;
+        }
+
+        bool skip() {
+          ws();
+          if (p >= last) return false;
+
+          switch (*p) {
+            case '"': { std::string_view s; return string(s); }
+            case '{': case '[': {
+              char close = *p == '{' ? '}' : ']';
+              p++;
+              if (consume(close)) return true;
+              do {
+                if (close == '}') {
+                  std::string_view k;
+                  if (!string(k) || !consume(':')) return false;
+                }
+                if (!skip()) return false;
+              } while (consume(','));
+              return consume(close);
+            }
+            case 't': return literal("true");
+            case 'f': return literal("false");
+            case 'n': return literal("null");
+            default: {
+              const char * begin = p;
+              while (p < last && (std::isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E')) p++;
+              return p != begin;
+            }
+          }
+        }
+
+        // Steps over an object by brace matching alone; it is validated when
+        // (if ever) it is parsed.
+        bool jump() {
+          if (p >= last || *p != '{') return skip();
+
+          objects.clear();
+          open.clear();
+          const char * listing = nullptr; // the value of the last "files" key, if an object
+          for (size_t depth = 0; p < last;) {
+            char c = *p++;
+            if (c == '"') {
+              const char * begin = p;
+              while (p < last && *p != '"') {
+                if (*p == '\\' && ++p == last) return false;
+                p++;
+              }
+              if (p == last) return false;
+              p++;
+              std::string_view key(begin, p - 1 - begin);
+              if (extent) field(key);
+              if (listed && key == "files") listing = value();
+            }
+            else if (c == '{' || c == '[') {
+              depth++;
+              if (extent) objects.emplace_back();
+              if (p - 1 == listing) {
+                open.emplace_back(depth, listed->size());
+                listed->emplace_back(listing, nullptr);
+              }
+            }
+            else if (c == '}' || c == ']') {
+              if (extent) {
+                const Object & o = objects.back();
+                if (o.placed && !o.unpacked) *extent = std::max(*extent, o.offset + o.size);
+                objects.pop_back();
+              }
+              if (!open.empty() && open.back().first == depth) {
+                (*listed)[open.back().second].second = p;
+                open.pop_back();
+              }
+              if (--depth == 0) return true;
+            }
+          }
+
+          return false;
+        }
+
+        // After a key in jump(): where its value starts if that is an object.
+        const char * value() {
+          const char * mark = p, * at = nullptr;
+          if (consume(':')) {
+            ws();
+            if (p < last && *p == '{') at = p;
+          }
+          p = mark;
+          return at;
+        }
+
+        // Steps over a "files" object jump() has measured before, if it has.
+        bool measured() {
+          if (!known) return false;
+          auto it = std::lower_bound(known->begin(), known->end(), p, [](const std::pair<const char *, const char *> & r, const char * at) {
+            return r.first < at;
+          });
+          if (it == known->end() || it->first != p || !it->second) return false;
+          p = it->second;
+          return true;
+        }
+
+        // After a string in jump(): reads its value if it is one of the keys
+        // extent needs, or else leaves p where it was.
+        void field(std::string_view key) {
+          const char * mark = p;
+          Object & o = objects.back();
+          if (key == "offset" && consume(':') && number(o.offset)) o.placed = true;
+          else if (key == "size" && consume(':') && number(o.size)) {}
+          else if (key == "unpacked" && consume(':') && boolean(o.unpacked)) {}
+          else p = mark;
+        }
+
+        static bool hex(std::string_view text, uint8_t * out) {
+          if (text.size() != 64) return false;
+          for (size_t i = 0; i < 64; i++) {
+            char h = text[i];
+            int v = h >= '0' && h <= '9' ? h - '0' : h >= 'a' && h <= 'f' ? h - 'a' + 10 : h >= 'A' && h <= 'F' ? h - 'A' + 10 : -1;
+            if (v < 0) return false;
+            out[i / 2] = i % 2 ? out[i / 2] | v : v << 4;
+          }
+          return true;
+        }
+
+        // Only SHA256 block digests are kept; they cover the whole content,
+        // so the file-level "hash" is redundant. Anything else is ignored.
+        bool integrity(size_t index) {
+          Integrity in{};
+          in.first = out.digests.size() / 32;
+          bool supported = false, valid = true;
+
+          if (!consume('{')) return false;
+          if (!consume('}')) {
+            do {
+              std::string_view k;
+              if (!string(k) || !consume(':')) return false;
+
+              if (k == "algorithm") {
+                std::string_view algorithm;
+                if (!string(algorithm)) return false;
+                supported = algorithm == "SHA256";
+              } else if (k == "blockSize") {
+                if (!number(in.blockSize)) return false;
+              } else if (k == "blocks") {
+                if (!consume('[')) return false;
+                if (!consume(']')) {
+                  do {
+                    std::string_view digest;
+                    if (!string(digest)) return false;
+                    out.digests.resize(out.digests.size() + 32);
+                    valid &= hex(digest, &out.digests[out.digests.size() - 32]);
+                    in.count++;
+                  } while (consume(','));
+                  if (!consume(']')) return false;
+                }
+              } else if (!skip()) return false;
+            } while (consume(','));
+            if (!consume('}')) return false;
+          }
+
+          if (!supported || !valid || !in.blockSize || !in.count) {
+            out.digests.resize(size_t(in.first) * 32);
+            return true;
+          }
+
+          out.integrities.push_back(in);
+          out.entries[index].integrity = out.integrities.size();
+          return true;
+        }
+
+        bool node() {
+          size_t index = out.entries.size();
+          Entry e{};
+          e.name = out.names.size();
+          e.length = path.size();
+          out.names += path;
+          out.entries.push_back(e);
+
+          ws();
+          const char * begin = p;
+          if (!consume('{')) return false;
+          if (consume('}')) return span(index, begin);
+
+          std::pair<uint64_t, uint64_t> link; // target path in names
+          do {
+            std::string_view k;
+            if (!string(k) || !consume(':')) return false;
+
+            bool ok = true, flag = false;
+            uint32_t bit = 0;
+            if (k == "files") {
+              out.entries[index].flags |= Directory;
+              ws();
+              const char * begin = p;
+              if (deferred) {
+                ok = measured() || jump();
+                deferred->resize(out.entries.size());
+                (*deferred)[index] = {begin, p};
+              } else ok = files();
+              if (ok && spans) {
+                spans->listings.resize(out.entries.size());
+                spans->listings[index] = {begin, p};
+              }
+            }
+            else if (k == "size") ok = number(out.entries[index].size);
+            else if (k == "offset") {
+              ws();
+              const char * begin = p;
+              ok = number(out.entries[index].offset);
+              if (offsets) {
+                offsets->resize(out.entries.size());
+                (*offsets)[index] = {begin, p};
+              }
+            }
+            else if (k == "unpacked") { ok = boolean(flag); bit = Unpacked; }
+            else if (k == "executable") { ok = boolean(flag); bit = Executable; }
+            else if (k == "link") {
+              std::string_view target;
+              ok = string(target);
+              link = {out.names.size(), target.size()};
+              out.names += target;
+              out.entries[index].flags |= Link;
+            }
+            else if (k == "integrity") ok = deferred ? skip() : integrity(index);
+            else ok = skip();
+
+            if (!ok) return false;
+            if (flag) out.entries[index].flags |= bit;
+          } while (consume(','));
+
+          // Kept where finish() looks for it, whatever else the node holds.
+          if (out.entries[index].isLink()) {
+            out.entries[index].offset = link.first;
+            out.entries[index].size = link.second;
+          }
+          return consume('}') && span(index, begin);
+        }
+
+        bool span(size_t index, const char * begin) {
+          if (spans) {
+            spans->nodes.resize(out.entries.size());
+            spans->nodes[index] = {begin, p};
+          }
+          return true;
+        }
+    };
+
+    template <typename T>
+    static Table<T> table(const std::vector<T> & v) { return Table<T>{v.data(), v.size()}; }
+
+    // Sorts the parsed entries by path, hashes them and publishes the tables.
+    // A parent sorts before its children, so the order stays a valid
+    // creation order.
+    void finish() const {
+      const std::string & text = built.names;
+      auto path = [&](const Entry & e) { return std::string_view(text.data() + e.name, e.length); };
+      std::sort(built.entries.begin(), built.entries.end(), [&](const Entry & a, const Entry & b) {
+        return path(a) < path(b);
+      });
+      rehash(built);
+
+      entries = table(built.entries);
+      slots = table(built.slots);
+      names = Table<char>{text.data(), text.size()};
+      integrities = table(built.integrities);
+      digests = table(built.digests);
+
+      // The parser left each link's target path in names (at offset, size
+      // bytes long). Chains are followed to their end once, here; a link
+      // met again while it is being resolved closes a cycle and dangles.
+      std::vector<uint8_t> state(built.entries.size()); // 0 pending, 1 resolving, 2 done
+      std::function<const Entry * (const Entry &, unsigned)> next = [&](const Entry & link, unsigned hops) -> const Entry * {
+        size_t i = &link - entries.data;
+        if (state[i] == 2) return link.offset ? &entries[link.offset - 1] : nullptr;
+        if (state[i] == 1) return nullptr;
+
+        state[i] = 1;
+        std::string target(normalize(std::string_view(text.data() + link.offset, link.size)));
+        const Entry * t = follow({}, target, next, hops + 1);
+
+        Entry & e = built.entries[i];
+        e.offset = t ? t - entries.data + 1 : 0;
+        e.size = t ? t->size : 0;
+        state[i] = 2;
+        return t;
+      };
+
+      linkedDirectories = false;
+      for (const Entry & e : built.entries)
+        if (e.isLink()) {
+          const Entry * t = next(e, 0);
+          if (t && t->isDirectory()) linkedDirectories = true;
+        }
+    }
+
+    static void rehash(Storage & storage) {
+      size_t capacity = 16;
+      while (capacity < storage.entries.size() * 2) capacity <<= 1;
+      storage.slots.assign(capacity, 0);
+
+      for (uint32_t i = 0; i < storage.entries.size(); i++) {
+        const Entry & e = storage.entries[i];
+        size_t s = hash(std::string_view(storage.names.data() + e.name, e.length)) & (capacity - 1);
+        while (storage.slots[s]) s = (s + 1) & (capacity - 1);
+        storage.slots[s] = i + 1;
+      }
+    }
+
+#ifdef ASAR_POSIX
+    // Index file: an IndexHeader followed by the five tables, each padded
+    // to 8 bytes, in native byte order. Loading is a bounds check and a
+    // handful of pointer assignments.
+    static size_t padded(size_t size) { return (size + 7) & ~size_t(7); }
+
+    bool writeIndex(int out) const {
+      IndexHeader header{};
+      std::memcpy(header.magic, "ASARIDX3", 8);
+      header.stamp = stamp;
+      header.headerAt = headerAt;
+      header.headerSize = headerSize;
+      header.entries = entries.size();
+      header.slots = slots.size();
+      header.names = names.size();
+      header.integrities = integrities.size();
+      header.digests = digests.size();
+
+      auto write = [&](const void * data, size_t size) {
+        for (const char * p = (const char *)data; size > 0;) {
+          ssize_t n = ::write(out, p, size);
+          if (n <= 0) return false;
+          p += n; size -= n;
+        }
+        return true;
+      };
+      auto section = [&](const void * data, size_t size) {
+        static const char zero[8] = {};
+        return write(data, size) && write(zero, padded(size) - size);
+      };
+
+      return section(&header, sizeof(header)) &&
+        section(entries.data, entries.size() * sizeof(Entry)) &&
+        section(slots.data, slots.size() * sizeof(uint32_t)) &&
+        section(names.data, names.size()) &&
+        section(integrities.data, integrities.size() * sizeof(Integrity)) &&
+        section(digests.data, digests.size());
+    }
+
+    bool mapIndex(int in) {
+      struct stat st;
+      if (fstat(in, &st) != 0 || size_t(st.st_size) < sizeof(IndexHeader)) return false;
+
+      void * address = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, in, 0);
+      if (address == MAP_FAILED) return false;
+
+      const char * base = (const char *)address;
+      IndexHeader header;
+      std::memcpy(&header, base, sizeof(header));
+
+      size_t at = padded(sizeof(header)), size = st.st_size;
+      auto place = [&](auto & t, uint64_t count) {
+        using T = typename std::remove_reference<decltype(t[0])>::type;
+        if (count > (size - at) / sizeof(T)) return false;
+        t = {(const T *)(base + at), size_t(count)};
+        at += padded(count * sizeof(T));
+        return at <= size;
+      };
+
+      Index index;
+      bool ok = std::memcmp(header.magic, "ASARIDX3", 8) == 0 &&
+        std::memcmp(&header.stamp, &stamp, sizeof(stamp)) == 0 &&
+        place(index.entries, header.entries) && place(index.slots, header.slots) &&
+        place(index.names, header.names) && place(index.integrities, header.integrities) &&
+        place(index.digests, header.digests) && valid(index);
+
+      if (!ok) { munmap(address, st.st_size); return false; }
+
+      indexMapping = base;
+      indexLength = st.st_size;
+      headerAt = header.headerAt;
+      headerSize = header.headerSize;
+      entries = index.entries; slots = index.slots; names = index.names;
+      integrities = index.integrities; digests = index.digests;
+      linkedDirectories = std::any_of(entries.begin(), entries.end(), [this](const Entry & e) {
+        return e.isLink() && e.offset && entries[e.offset - 1].isDirectory();
+      });
+      return true;
+    }
+
+    struct Index {
+      Table<Entry> entries;
+      Table<uint32_t> slots;
+      Table<char> names;
+      Table<Integrity> integrities;
+      Table<uint8_t> digests;
+    };
+
+    // Every offset inside a foreign index must stay within its tables, and
+    // the hash table needs a free slot to terminate probes.
+    static bool valid(const Index & index) {
+      size_t count = index.entries.size(), capacity = index.slots.size();
+      if ((capacity & (capacity - 1)) != 0 || (capacity ? capacity <= count : count != 0)) return false;
+      if (index.digests.size() % 32 != 0) return false;
+
+      for (auto & e : index.entries) {
+        if (e.name > index.names.size() || e.length > index.names.size() - e.name) return false;
+        if (e.isLink() && e.offset > count) return false;
+        if (!e.integrity) continue;
+        if (e.integrity > index.integrities.size()) return false;
+        const Integrity & in = index.integrities[e.integrity - 1];
+        if (!in.blockSize || uint64_t(in.first) + in.count > index.digests.size() / 32) return false;
+      }
+      for (uint32_t slot : index.slots)
+        if (slot > count) return false;
+
+      return true;
+    }
+
+    bool loadIndex(const std::string & path) {
+      int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (in < 0) return false;
+      bool ok = mapIndex(in);
+      ::close(in);
+      return ok;
+    }
+#else
+    // Without POSIX there are no index files; the header is always parsed.
+    bool mapIndex(int) { return false; }
+    bool loadIndex(const std::string &) { return false; }
+#endif
+  };
+
+#ifdef ASAR_POSIX
+// Non-blocking unpack for event loops. Reads are submitted through io_uring
+// when the kernel allows it, otherwise handed to a few blocking reader
+// threads; either way completions are signalled on fd() (an eventfd) and
+// delivered by poll()/wait() on the owning thread, so hundreds of reads can
+// be in flight from one thread. An Async is not itself thread-safe.
+class Asar::Async {
+  public:
+    using Callback = std::function<void(std::string)>;
+
+    Async(const Asar & _asar, unsigned depth = 256) : asar(_asar) {
+#ifdef __linux__
+      event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+#ifdef ASAR_IO_URING
+      if (event >= 0 && setup(depth)) return;
+#else
+      (void)depth;
+#endif
+      for (unsigned i = 0; i < 4; i++) workers.emplace_back([this] { work(); });
+    }
+
+    Async(const Async &) = delete;
+    Async & operator=(const Async &) = delete;
+
+    ~Async() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wake.notify_all();
+      for (auto & t : workers) t.join();
+
+#ifdef ASAR_IO_URING
+      if (ring >= 0) {
+        while (inflight) { enter(0, 1); reap(false); }
+        munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+        if (cqRing != sqRing) munmap(cqRing, cqSize);
+        munmap(sqRing, sqSize);
+        ::close(ring);
+      }
+#endif
+      for (auto * r : backlog) delete r;
+      for (auto * r : finished) delete r;
+      if (event >= 0) ::close(event);
+    }
+
+    // The callback runs from poll()/wait() with the entry's bytes, or with
+    // an empty string when the path is missing or the read fails.
+    void unpack(const std::string_view path, Callback callback) {
+      Request * r = new Request{};
+      r->callback = std::move(callback);
+      pending++;
+
+      auto * c = asar.resolve(path);
+      Source source{-1, 0, nullptr};
+      if (c && !c->isDirectory() && asar.inside(*c)) source = asar.source(*c);
+
+      // Nothing to wait for in memory.
+      if (source.in == inMemory) {
+        r->entry = c;
+        if (asar.load(*c, r->data)) asar.note(path);
+        r->done = r->data.size();
+        complete(r);
+        return;
+      }
+
+      if (source.in != -1) {
+        r->entry = c;
+        r->in = source.in;
+        r->base = source.base;
+        r->file = std::move(source.file);
+        r->data.resize(c->size);
+        asar.note(path);
+      }
+
+      if (!r->entry || !c->size) { complete(r); return; }
+
+#ifdef ASAR_IO_URING
+      if (ring >= 0) { backlog.push_back(r); submit(); return; }
+#endif
+      std::lock_guard<std::mutex> lock(mutex);
+      backlog.push_back(r);
+      wake.notify_one();
+    }
+
+#ifdef ASAR_COROUTINES
+    struct Awaitable {
+      Async & async;
+      std::string_view path;
+      std::string result;
+
+      bool await_ready() const { return false; }
+      void await_suspend(std::coroutine_handle<> handle) {
+        async.unpack(path, [this, handle](std::string data) {
+          result = std::move(data);
+          handle.resume();
+        });
+      }
+      std::string await_resume() { return std::move(result); }
+    };
+
+    // co_await async.unpack(path): the coroutine resumes inside poll()/wait().
+    Awaitable unpack(const std::string_view path) {
+      return Awaitable{*this, path, {}};
+    }
+#endif
+
+    // Readable whenever poll() has work to deliver; register it with the
+    // event loop.
+    int fd() const { return event; }
+
+    size_t size() const { return pending; }
+
+    // Delivers every finished read without blocking; returns how many.
+    size_t poll() {
+      if (event >= 0) {
+        uint64_t count;
+        while (::read(event, &count, sizeof(count)) > 0) {}
+      }
+
+#ifdef ASAR_IO_URING
+      if (ring >= 0) { reap(true); submit(); }
+#endif
+
+      std::deque<Request *> ready;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.swap(finished);
+      }
+
+      for (auto * r : ready) {
+        if (r->entry && (r->done != r->data.size() || !asar.verified(*r->entry, 0, r->data.size()))) r->data.clear();
+        Callback callback = std::move(r->callback);
+        std::string data = std::move(r->data);
+        delete r;
+        pending--;
+        callback(std::move(data));
+      }
+
+      return ready.size();
+    }
+
+    // Blocks until at least one read has finished, then delivers.
+    size_t wait() {
+      if (!pending) return 0;
+
+      size_t delivered = poll();
+      while (!delivered && pending) {
+#ifdef ASAR_IO_URING
+        if (ring >= 0) enter(0, 1);
+        else
+#endif
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          done.wait(lock, [this] { return !finished.empty(); });
+        }
+        delivered = poll();
+      }
+      return delivered;
+    }
+
+  private:
+    struct Request {
+      const Entry * entry;
+      int in; // the archive, or an unpacked entry's file
+      uint64_t base;
+      std::shared_ptr<const int> file;
+      std::string data;
+      uint64_t done;
+      iovec iov;
+      Callback callback;
+    };
+
+    const Asar & asar;
+    int event = -1;
+    size_t pending = 0;
+
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::deque<Request *> backlog, finished;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+    void complete(Request * r) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(r);
+      }
+      done.notify_one();
+      if (event >= 0) {
+        uint64_t one = 1;
+        (void)!::write(event, &one, sizeof(one));
+      }
+    }
+
+    void work() {
+      for (;;) {
+        Request * r;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          wake.wait(lock, [this] { return stopping || !backlog.empty(); });
+          if (backlog.empty()) return;
+          r = backlog.front();
+          backlog.pop_front();
+        }
+
+        while (r->done < r->data.size()) {
+          ssize_t n = pread(r->in, &r->data[r->done], r->data.size() - r->done, r->base + r->done);
+          asar.count(Reads);
+          if (n <= 0) break;
+          asar.count(Bytes, n);
+          r->done += n;
+        }
+        complete(r);
+      }
+    }
+
+#ifdef ASAR_IO_URING
+    int ring = -1;
+    io_uring_params params{};
+    void * sqRing = nullptr;
+    void * cqRing = nullptr;
+    size_t sqSize = 0, cqSize = 0;
+    io_uring_sqe * sqes = nullptr;
+    unsigned * sqHead, * sqTail, * sqMask, * sqArray;
+    unsigned * cqHead, * cqTail, * cqMask;
+    io_uring_cqe * cqes;
+    unsigned inflight = 0;
+
+    bool setup(unsigned depth) {
+      ring = syscall(__NR_io_uring_setup, std::max(1u, depth), &params);
+      if (ring < 0) return false;
+
+      sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+      if (single) sqSize = cqSize = std::max(sqSize, cqSize);
+
+      sqRing = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+      cqRing = single ? sqRing : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+      void * entries = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+
+      if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || entries == MAP_FAILED ||
+          syscall(__NR_io_uring_register, ring, IORING_REGISTER_EVENTFD, &event, 1) != 0) {
+        if (entries != MAP_FAILED) munmap(entries, params.sq_entries * sizeof(io_uring_sqe));
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqSize);
+        ::close(ring);
+        ring = -1;
+        return false;
+      }
+
+      char * sq = (char *)sqRing, * cq = (char *)cqRing;
+      sqHead = (unsigned *)(sq + params.sq_off.head);
+      sqTail = (unsigned *)(sq + params.sq_off.tail);
+      sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+      sqArray = (unsigned *)(sq + params.sq_off.array);
+      cqHead = (unsigned *)(cq + params.cq_off.head);
+      cqTail = (unsigned *)(cq + params.cq_off.tail);
+      cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+      cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+      sqes = (io_uring_sqe *)entries;
+      return true;
+    }
+
+    int enter(unsigned submit, unsigned wait) {
+      return syscall(__NR_io_uring_enter, ring, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    }
+
+    // Moves backlog into the submission queue, never exceeding what the
+    // completion queue can hold.
+    void submit() {
+      unsigned tail = *sqTail, queued = 0;
+      unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+      while (!backlog.empty() && inflight < params.cq_entries && tail - head < params.sq_entries) {
+        Request * r = backlog.front();
+        backlog.pop_front();
+
+        r->iov.iov_base = &r->data[r->done];
+        r->iov.iov_len = r->data.size() - r->done;
+
+        unsigned index = tail & *sqMask;
+        io_uring_sqe & sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV;
+        sqe.fd = r->in;
+        sqe.off = r->base + r->done;
+        sqe.addr = (uint64_t)&r->iov;
+        sqe.len = 1;
+        sqe.user_data = (uint64_t)r;
+        sqArray[index] = index;
+
+        tail++;
+        queued++;
+        inflight++;
+      }
+
+      if (!queued) return;
+      __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+      enter(queued, 0);
+    }
+
+    // Short reads are resubmitted for the remainder; everything else is
+    // finished (or dropped while shutting down).
+    void reap(bool deliver) {
+      unsigned head = *cqHead;
+      unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+      for (; head != tail; head++) {
+        io_uring_cqe & cqe = cqes[head & *cqMask];
+        Request * r = (Request *)cqe.user_data;
+        inflight--;
+
+        asar.count(Reads);
+        if (cqe.res > 0) { r->done += cqe.res; asar.count(Bytes, cqe.res); }
+        if (!deliver) { delete r; continue; }
+        if (cqe.res > 0 && r->done < r->data.size()) { backlog.push_back(r); continue; }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(r);
+      }
+
+      __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+#endif
+};
+
+// Builds archives that this reader (and electron) can open. Entries are
+// collected first (files on disk, buffers, links, whole directory trees);
+// write() lays their data out in the order they were added. Digests are
+// fixed-width hex, so the header's size is known before anything is hashed:
+// write() reserves it, streams every file straight to its final offset while
+// a pool of threads hashes the blocks, and fills the digests in last. Memory
+// use is one block per thread plus the header, whatever the archive size.
+class Asar::Writer {
+  public:
+    static constexpr uint64_t blockSize = 4 << 20; // electron's default
+
+    Writer(bool _integrity = true) : integrity(_integrity) {}
+
+    bool addFile(std::string_view path, const std::string & source, bool executable = false) {
+      struct stat st;
+      if (::stat(source.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+
+      Item * item = add(path, executable ? uint32_t(Executable) : 0u);
+      if (!item) return false;
+      item->size = st.st_size;
+      item->source = source;
+      return true;
+    }
+
+    bool addData(std::string_view path, std::string data, bool executable = false) {
+      Item * item = add(path, executable ? uint32_t(Executable) : 0u);
+      if (!item) return false;
+      item->size = data.size();
+      item->data = std::move(data);
+      return true;
+    }
+
+    // target is a path inside the archive, relative to its root.
+    bool addLink(std::string_view path, std::string_view target) {
+      Item * item = add(path, Link);
+      if (!item) return false;
+      item->link = normalize(target);
+      return true;
+    }
+
+    bool addDirectory(std::string_view path) {
+      return add(path, Directory) != nullptr;
+    }
+
+    // Adds everything below directory under prefix, in name order. Symbolic
+    // links that stay inside directory become links; others are followed.
+    bool addTree(const std::string & directory, std::string_view prefix = "") {
+      std::string root(normalize(prefix));
+      if (!root.empty() && !addDirectory(root)) return false;
+      return tree(directory, root, root);
+    }
+
+    bool write(const std::string & output, unsigned threads = std::thread::hardware_concurrency()) {
+      uint64_t total = 0;
+      std::vector<size_t> files;
+      for (size_t i = 0; i < items.size(); i++) {
+        if (items[i].flags & (Directory | Link)) continue;
+        items[i].offset = total;
+        total += items[i].size;
+        files.push_back(i);
+      }
+
+      std::string header = json();
+      if (header.size() > std::numeric_limits<uint32_t>::max() - 16) return false;
+
+      uint8_t prefix[16];
+      pickle(header.size(), prefix);
+      size_t padded = (header.size() + 3) & ~size_t(3);
+      header.resize(padded, '\0');
+      uint64_t base = 16 + padded;
+
+      return replace(output, [&](int out) {
+        std::atomic<bool> ok{ftruncate(out, base + total) == 0};
+        parallel(files.size(), threads, [&](size_t i) {
+          if (ok && !store(items[files[i]], out, base, header)) ok = false;
+        });
+        return ok && pwrite(out, prefix, 16, 0) == 16 && pwrite(out, header.data(), padded, 16) == ssize_t(padded);
+      });
+    }
+
+  protected:
+    struct Item {
+      std::string path; // normalized
+      uint32_t flags = 0;
+      uint64_t size = 0;
+      uint64_t offset = 0;
+      std::string source; // file on disk, unless the data is in memory
+      std::string data;
+      std::string link;
+      size_t hash = 0;   // where the digests go in the header
+      size_t blocks = 0;
+    };
+
+    bool integrity;
+    std::vector<Item> items;
+    std::unordered_map<std::string, size_t> known; // path -> item
+
+    Item * add(std::string_view path, uint32_t flags) {
+      std::string name(normalize(path));
+      if (name.empty() || !safe(name)) return nullptr;
+
+      auto it = known.find(name);
+      if (it != known.end()) return (flags & Directory) && (items[it->second].flags & Directory) ? &items[it->second] : nullptr;
+
+      size_t slash = name.rfind('/');
+      if (slash != std::string::npos) {
+        Item * parent = add(std::string_view(name).substr(0, slash), Directory);
+        if (!parent || !(parent->flags & Directory)) return nullptr;
+      }
+
+      known.emplace(name, items.size());
+      items.emplace_back();
+      items.back().path = std::move(name);
+      items.back().flags = flags;
+      return &items.back();
+    }
+
+    bool tree(const std::string & directory, const std::string & prefix, const std::string & root) {
+      DIR * dir = opendir(directory.c_str());
+      if (!dir) return false;
+
+      std::vector<std::string> names;
+      while (dirent * d = readdir(dir))
+        if (std::strcmp(d->d_name, ".") && std::strcmp(d->d_name, "..")) names.emplace_back(d->d_name);
+      closedir(dir);
+      std::sort(names.begin(), names.end());
+
+      for (auto & name : names) {
+        std::string source = directory + '/' + name;
+        std::string path = prefix.empty() ? name : prefix + '/' + name;
+
+        struct stat st;
+        if (lstat(source.c_str(), &st) != 0) return false;
+
+        if (S_ISLNK(st.st_mode)) {
+          std::string target = within(source, prefix, root);
+          if (!target.empty()) { if (!addLink(path, target)) return false; continue; }
+          if (::stat(source.c_str(), &st) != 0) return false;
+        }
+
+        bool ok = true;
+        if (S_ISDIR(st.st_mode)) ok = addDirectory(path) && tree(source, path, root);
+        else if (S_ISREG(st.st_mode)) ok = addFile(path, source, st.st_mode & S_IXUSR);
+        if (!ok) return false;
+      }
+
+      return true;
+    }
+
+    // The archive path a symbolic link points to, or "" when it leaves the
+    // tree being added (absolute, or too many "..").
+    static std::string within(const std::string & link, const std::string & prefix, const std::string & root) {
+      char buffer[PATH_MAX];
+      ssize_t n = readlink(link.c_str(), buffer, sizeof buffer);
+      if (n <= 0 || buffer[0] == '/') return "";
+
+      std::vector<std::string_view> parts;
+      std::string_view base(prefix), target(buffer, n);
+      for (std::string_view from : {base, target}) {
+        while (!from.empty()) {
+          size_t e = from.find('/');
+          std::string_view part = from.substr(0, e);
+          if (part == "..") {
+            if (parts.empty()) return "";
+            parts.pop_back();
+          }
+          else if (!part.empty() && part != ".") parts.push_back(part);
+          if (e == std::string_view::npos) break;
+          from.remove_prefix(e + 1);
+        }
+      }
+
+      std::string out;
+      for (auto part : parts) out += (out.empty() ? "" : "/") + std::string(part);
+      if (out.size() < root.size() || out.compare(0, root.size(), root) != 0) return "";
+      if (!root.empty() && out.size() > root.size() && out[root.size()] != '/') return "";
+      return out;
+    }
+
+    static std::string escape(std::string_view text) {
+      std::string out;
+      for (unsigned char c : text) {
+        if (c == '"' || c == '\\') { out += '\\'; out += char(c); }
+        else if (c < 0x20) {
+          char code[8];
+          std::snprintf(code, sizeof code, "\\u%04x", c);
+          out += code;
+        }
+        else out += char(c);
+      }
+      return out;
+    }
+
+    std::string_view name(size_t i) const {
+      size_t slash = items[i].path.rfind('/');
+      return std::string_view(items[i].path).substr(slash == std::string::npos ? 0 : slash + 1);
+    }
+
+    // The children of every item in name order; the last list is the root's.
+    std::vector<std::vector<size_t>> children() {
+      std::vector<std::vector<size_t>> out(items.size() + 1);
+      for (size_t i = 0; i < items.size(); i++) {
+        size_t slash = items[i].path.rfind('/');
+        out[slash == std::string::npos ? items.size() : known[items[i].path.substr(0, slash)]].push_back(i);
+      }
+
+      for (auto & list : out)
+        std::sort(list.begin(), list.end(), [&](size_t a, size_t b) { return name(a) < name(b); });
+      return out;
+    }
+
+    // Appends item i (the root for items.size()) to out, with zeroed
+    // digests whose positions in out are kept in the items.
+    void json(size_t i, const std::vector<std::vector<size_t>> & children, std::string & out) {
+      if (i == items.size() || items[i].flags & Directory) {
+        out += "{\"files\":{";
+        for (size_t k = 0; k < children[i].size(); k++) {
+          if (k) out += ',';
+          out += '"' + escape(name(children[i][k])) + "\":";
+          json(children[i][k], children, out);
+        }
+        out += "}}";
+        return;
+      }
+
+      Item & item = items[i];
+      if (item.flags & Link) { out += "{\"link\":\"" + escape(item.link) + "\"}"; return; }
+
+      out += "{\"size\":" + std::to_string(item.size) + ",\"offset\":\"" + std::to_string(item.offset) + '"';
+      if (item.flags & Executable) out += ",\"executable\":true";
+      if (integrity) {
+        out += ",\"integrity\":{\"algorithm\":\"SHA256\",\"hash\":\"";
+        item.hash = out.size();
+        out += std::string(64, '0') + "\",\"blockSize\":" + std::to_string(blockSize) + ",\"blocks\":[";
+        item.blocks = out.size();
+        // One digest per started block plus the (possibly empty) rest, as
+        // Electron's packer writes them.
+        uint64_t count = item.size / blockSize + 1;
+        for (uint64_t b = 0; b < count; b++) out += (b ? ",\"" : "\"") + std::string(64, '0') + '"';
+        out += "]}";
+      }
+      out += '}';
+    }
+
+    std::string json() {
+      std::string out;
+      json(items.size(), children(), out);
+      return out;
+    }
+
+    static void hex(const uint8_t digest[32], char * out) {
+      static const char * digits = "0123456789abcdef";
+      for (int i = 0; i < 32; i++) { out[i * 2] = digits[digest[i] >> 4]; out[i * 2 + 1] = digits[digest[i] & 15]; }
+    }
+
+    // Copies one entry to its place in out and, with integrity on, hashes
+    // it block by block on the way. Different items touch disjoint parts of
+    // the header, so workers need no locking.
+    bool store(Item & item, int out, uint64_t base, std::string & header) {
+      int in = -1;
+      if (!item.source.empty() && (in = ::open(item.source.c_str(), O_RDONLY | O_CLOEXEC)) < 0) return false;
+
+      bool ok = true;
+#ifdef __linux__
+      if (in >= 0 && !integrity) {
+        loff_t from = 0, to = base + item.offset;
+        uint64_t left = item.size;
+        while (left > 0) {
+          ssize_t n = copy_file_range(in, &from, out, &to, left, 0);
+          if (n <= 0) break;
+          left -= n;
+        }
+        if (left == 0) { ::close(in); return true; }
+      }
+#endif
+
+      std::vector<char> buffer(in >= 0 ? std::min<uint64_t>(item.size, blockSize) : 0);
+      sha256::Hasher whole;
+      uint8_t digest[32];
+
+      for (uint64_t at = 0, b = 0; ok && b <= item.size / blockSize; b++) {
+        uint64_t n = std::min<uint64_t>(blockSize, item.size - at);
+        const char * data = item.data.data() + at;
+
+        if (in >= 0) {
+          for (uint64_t done = 0; ok && done < n;) {
+            ssize_t got = pread(in, &buffer[done], n - done, at + done);
+            if (got <= 0) ok = false;
+            else done += got;
+          }
+          data = buffer.data();
+        }
+
+        for (uint64_t done = 0; ok && done < n;) {
+          ssize_t put = pwrite(out, data + done, n - done, base + item.offset + at + done);
+          if (put <= 0) ok = false;
+          else done += put;
+        }
+
+        if (ok && integrity) {
+          whole.update(data, n);
+          sha256::digest(data, n, digest);
+          hex(digest, &header[item.blocks + 1 + b * 67]); // "<64 hex>",
+        }
+        at += n;
+      }
+
+      if (ok && integrity) {
+        whole.finish(digest);
+        hex(digest, &header[item.hash]);
+      }
+
+      if (in >= 0) ::close(in);
+      return ok;
+    }
+};
+
+using AsarWriter = Asar::Writer;
+
+// Changes an archive in place by appending to it: the data of added and
+// replaced entries, then a new header and a trailer pointing at it, which
+// Asar prefers over the header at the front. No byte already in the file
+// changes, so readers that have it open keep their view, and other asar
+// readers keep seeing the original contents. The new header is the current
+// one with only the directories on changed paths re-rendered; the rest is
+// copied verbatim. Superseded data stays behind as dead space until
+// compact(). Updates of one archive are serialized with flock(); one that
+// is interrupted before its trailer is written leaves readers on the last
+// one that was, and is cut off by the next.
+class Asar::Updater : protected Asar::Writer {
+  public:
+    Updater(const std::string & _filename, bool integrity = true) : Writer(integrity), filename(_filename) {}
+
+    // Added paths replace what the archive holds there; added directories
+    // merge with existing ones.
+    using Writer::addFile;
+    using Writer::addData;
+    using Writer::addLink;
+    using Writer::addDirectory;
+    using Writer::addTree;
+
+    // Drops path, with everything below it. Adding the same path as well
+    // replaces it instead, e.g. a directory without its old contents.
+    bool remove(std::string_view path) {
+      std::string name(normalize(path));
+      if (name.empty() || !safe(name)) return false;
+      removed.insert(std::move(name));
+      return true;
+    }
+
+    bool write(unsigned threads = std::thread::hardware_concurrency()) {
+      int out = ::open(filename.c_str(), O_RDWR | O_CLOEXEC);
+      if (out < 0) return false;
+
+      bool ok = flock(out, LOCK_EX) == 0 && append(out, threads);
+      return ::close(out) == 0 && ok;
+    }
+
+  private:
+    std::string filename;
+    std::unordered_set<std::string> removed;
+
+    bool append(int out, unsigned threads) {
+      if (items.empty() && removed.empty()) return true;
+
+      Asar archive(filename, Load::Lazy);
+      if (archive.fd < 0) return false;
+
+      std::string text(archive.headerSize, '\0');
+      if (!archive.readAt(&text[0], text.size(), archive.headerAt)) return false;
+
+      Storage parsed;
+      Parser::Spans spans;
+      Parser parser(text.data(), text.data() + text.size(), parsed);
+      parser.spans = &spans;
+      if (!parser.parse() || !spans.root.first) return false;
+
+      if (archive.leftovers) return ftruncate(out, archive.leftovers) == 0 && append(out, threads);
+
+      size_t count = parsed.entries.size();
+      spans.keys.resize(count);
+      spans.nodes.resize(count);
+      spans.listings.resize(count);
+      rehash(parsed);
+
+      Table<char> names{parsed.names.data(), parsed.names.size()};
+      auto find = [&](std::string_view path) { return probe(table(parsed.entries), table(parsed.slots), names, path); };
+      auto path = [&](size_t i) { return std::string_view(parsed.names.data() + parsed.entries[i].name, parsed.entries[i].length); };
+
+      // Every directory's entries in text order; the last list is the root's.
+      std::vector<std::vector<size_t>> listed(count + 1);
+      for (size_t i = 0; i < count; i++) {
+        size_t slash = path(i).rfind('/');
+        const Entry * parent = slash == std::string_view::npos ? nullptr : find(path(i).substr(0, slash));
+        listed[parent ? parent - parsed.entries.data() : count].push_back(i);
+      }
+
+      // Directories with changes somewhere below them.
+      std::unordered_set<std::string_view> touched;
+      auto touch = [&](std::string_view changed) {
+        for (size_t slash = changed.rfind('/'); slash != std::string_view::npos && slash > 0; slash = changed.rfind('/', slash - 1))
+          if (!touched.insert(changed.substr(0, slash)).second) break;
+      };
+      for (const Item & item : items) touch(item.path);
+      for (const std::string & gone : removed) touch(gone);
+
+      uint64_t at = archive.length, total = 0;
+      std::vector<size_t> files;
+      for (size_t i = 0; i < items.size(); i++) {
+        if (items[i].flags & (Directory | Link)) continue;
+        items[i].offset = at - archive.offset + total;
+        total += items[i].size;
+        files.push_back(i);
+      }
+
+      // Touched directories that stay directories are re-rendered member by
+      // member; everything else is either copied or replaced whole.
+      std::vector<std::vector<size_t>> children = this->children();
+      std::string header;
+      header.reserve(text.size() + 4096);
+      auto copy = [&](const char * from, const char * to) { header.append(from, to - from); };
+
+      std::function<void(size_t)> listing = [&](size_t dir) {
+        auto mine = dir == count ? known.end() : known.find(std::string(path(dir)));
+        size_t self = dir == count ? items.size() : mine == known.end() ? std::string::npos : mine->second;
+
+        header += '{';
+        bool first = true;
+        for (size_t c : listed[dir]) {
+          std::string key(path(c));
+          auto it = known.find(key);
+          bool gone = removed.count(key);
+          bool merged = parsed.entries[c].isDirectory() && !gone &&
+            (it == known.end() ? touched.count(key) : items[it->second].flags & Directory);
+          if (it == known.end() && gone) continue;
+
+          if (!first) header += ',';
+          first = false;
+          if (merged) {
+            copy(spans.keys[c], spans.listings[c].first);
+            listing(c);
+            copy(spans.listings[c].second, spans.nodes[c].second);
+          }
+          else if (it != known.end()) {
+            copy(spans.keys[c], spans.nodes[c].first);
+            json(it->second, children, header);
+          }
+          else copy(spans.keys[c], spans.nodes[c].second);
+        }
+
+        if (self != std::string::npos) {
+          for (size_t i : children[self]) {
+            if (find(items[i].path)) continue;
+            if (!first) header += ',';
+            first = false;
+            header += '"' + escape(name(i)) + "\":";
+            json(i, children, header);
+          }
+        }
+        header += '}';
+      };
+
+      copy(text.data(), spans.root.first);
+      listing(count);
+      copy(spans.root.second, text.data() + text.size());
+
+      // Data and header first, the trailer that makes them current last.
+      std::atomic<bool> ok{true};
+      parallel(files.size(), threads, [&](size_t k) {
+        if (ok && !store(items[files[k]], out, archive.offset, header)) ok = false;
+      });
+
+      uint8_t tail[32];
+      trailer(at + total, header.size(), tail);
+      bool good = ok && pwrite(out, header.data(), header.size(), at + total) == ssize_t(header.size()) &&
+        fdatasync(out) == 0 && pwrite(out, tail, 32, at + total + header.size()) == 32 && fdatasync(out) == 0;
+      if (!good) ftruncate(out, at);
+      return good;
+    }
+};
+
+using AsarUpdater = Asar::Updater;
+#endif
+
+// Several archives mounted as one tree, e.g. a base app.asar with hot
+// patches on top. Every path has one winner: the entry of the archive
+// mounted with the highest priority (the latest mount on ties). A single
+// hash index merged over all of them makes every lookup one probe, hit or
+// miss, whatever the number of archives. mount() inserts only the new
+// archive's entries; slots are published atomically, so lookups and reads
+// stay lock-free and may run while another thread mounts. When the table
+// has to grow, it is copied at twice the size and the old one is kept
+// until the Overlay is destroyed, for lookups still probing it. Links
+// resolve within the archive that holds them. A path is hidden when the
+// winner of a directory above it is a file, and resolves through the
+// winner's archive when that is a link.
+class Asar::Overlay {
+  public:
+    static constexpr size_t maxLayers = 1024;
+
+    struct Hit {
+      const Asar * archive = nullptr;
+      const Entry * entry = nullptr;
+
+      explicit operator bool() const { return entry != nullptr; }
+    };
+
+    Overlay() {
+      tables.emplace_back(new Table(16));
+      table = tables.back().get();
+    }
+
+    Overlay(const Overlay &) = delete;
+    Overlay & operator=(const Overlay &) = delete;
+
+    // index as in Asar(filename, index). Fails if the archive cannot be
+    // opened or maxLayers are mounted already.
+    bool mount(const std::string & filename, int priority = 0, const std::string & index = "") {
+      std::unique_ptr<Layer> layer(new Layer{std::unique_ptr<Asar>(new Asar(filename, index)), priority});
+      if (layer->archive->fd < 0) return false;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      size_t id = count.load(std::memory_order_relaxed);
+      if (id == maxLayers) return false;
+
+      const Asar & archive = *layer->archive;
+      layers[id].store(layer.get(), std::memory_order_release);
+      owned.push_back(std::move(layer));
+      count.store(id + 1, std::memory_order_release);
+      if (archive.linkedDirectories) links.store(true, std::memory_order_release);
+
+      Table * t = table.load(std::memory_order_relaxed);
+      if ((used + archive.entries.size()) * 2 > t->size) t = grow(used + archive.entries.size());
+      for (uint32_t i = 0; i < archive.entries.size(); i++) insert(*t, id, i);
+      return true;
+    }
+
+    Hit resolve(std::string_view path) const {
+      path = normalize(path);
+      const Table & t = *table.load(std::memory_order_acquire);
+      Hit hit = find(t, path, hash(path));
+
+      // Only a path a file or link replaces in some layer can be masked,
+      // and only a link to a directory leads where the index has no entry.
+      Hit above;
+      if ((hit ? masks : links).load(std::memory_order_acquire) && decide(t, path, above)) return above;
+
+      if (hit && hit.entry->isLink()) hit.entry = hit.entry->offset ? &hit.archive->entries[hit.entry->offset - 1] : nullptr;
+      return hit;
+    }
+
+    bool exist(const std::string_view path) const {
+      return bool(resolve(path));
+    }
+
+    std::string unpack(const std::string_view path) const {
+      Hit hit = resolve(path);
+      std::string data;
+      if (hit && !hit.entry->isDirectory() && hit.archive->load(*hit.entry, data)) hit.archive->note(path);
+      return data;
+    }
+
+    std::string read(const std::string_view path, uint64_t from, uint64_t size) const {
+      Hit hit = resolve(path);
+      std::string data;
+      if (hit && hit.archive->slice(*hit.entry, from, size, data)) hit.archive->note(path);
+      return data;
+    }
+
+#ifdef ASAR_POSIX
+    bool sendTo(const std::string_view path, int out, uint64_t from = 0, uint64_t size = std::numeric_limits<uint64_t>::max()) const {
+      Hit hit = resolve(path);
+      if (!hit || !hit.archive->send(*hit.entry, out, from, size)) return false;
+      hit.archive->note(path);
+      return true;
+    }
+#endif
+
+    std::string_view view(const std::string_view path) const {
+      Hit hit = resolve(path);
+      if (!hit || !hit.archive->mapped(*hit.entry)) return {};
+
+      hit.archive->note(path);
+      hit.archive->count(Bytes, hit.entry->size);
+      return std::string_view(hit.archive->mapping + hit.archive->offset + hit.entry->offset, hit.entry->size);
+    }
+
+    Reader open(const std::string_view path) const {
+      Hit hit = resolve(path);
+      if (!hit || hit.entry->isDirectory() || !hit.archive->inside(*hit.entry)) return Reader();
+
+      hit.archive->note(path);
+      return Reader(*hit.archive, *hit.entry);
+    }
+
+  private:
+    struct Layer {
+      std::unique_ptr<Asar> archive;
+      int priority;
+    };
+
+    // ref is the layer << 32 | the entry's index + 1, 0 for an empty slot;
+    // it is stored last (release), so a reader that sees it sees the hash.
+    struct Slot {
+      std::atomic<uint64_t> hash{0};
+      std::atomic<uint64_t> ref{0};
+    };
+
+    struct Table {
+      explicit Table(size_t _size) : size(_size), slots(new Slot[_size]) {}
+
+      size_t size; // a power of two
+      std::unique_ptr<Slot[]> slots;
+    };
+
+    std::atomic<const Layer *> layers[maxLayers] = {};
+    std::atomic<size_t> count{0};
+    std::atomic<bool> links{false}; // some layer links to a directory
+    std::atomic<bool> masks{false}; // some path is a directory in one layer and not in another
+    std::atomic<Table *> table{nullptr};
+
+    std::mutex mutex; // serializes mount()
+    std::vector<std::unique_ptr<Layer>> owned;
+    std::vector<std::unique_ptr<Table>> tables; // the last one is current
+    size_t used = 0;  // distinct paths
+
+    Hit at(uint64_t ref) const {
+      const Asar & archive = *layers[ref >> 32].load(std::memory_order_acquire)->archive;
+      return {&archive, &archive.entries[uint32_t(ref) - 1]};
+    }
+
+    // Keys are unique in a table, so moving them needs no comparisons.
+    Table * grow(size_t paths) {
+      const Table & old = *table.load(std::memory_order_relaxed);
+      size_t size = old.size;
+      while (size < paths * 2) size <<= 1;
+
+      Table * t = new Table(size);
+      tables.emplace_back(t);
+      for (size_t i = 0; i < old.size; i++) {
+        uint64_t ref = old.slots[i].ref.load(std::memory_order_relaxed);
+        if (!ref) continue;
+        uint64_t h = old.slots[i].hash.load(std::memory_order_relaxed);
+        size_t s = h & (size - 1);
+        while (t->slots[s].ref.load(std::memory_order_relaxed)) s = (s + 1) & (size - 1);
+        t->slots[s].hash.store(h, std::memory_order_relaxed);
+        t->slots[s].ref.store(ref, std::memory_order_relaxed);
+      }
+
+      table.store(t, std::memory_order_release);
+      return t;
+    }
+
+    // The winner of path, links not followed.
+    Hit find(const Table & t, std::string_view path, uint64_t h) const {
+      for (size_t s = h & (t.size - 1);; s = (s + 1) & (t.size - 1)) {
+        uint64_t ref = t.slots[s].ref.load(std::memory_order_acquire);
+        if (!ref) return {};
+        if (t.slots[s].hash.load(std::memory_order_relaxed) != h) continue;
+
+        Hit hit = at(ref);
+        if (hit.archive->key(*hit.entry) == path) return hit;
+      }
+    }
+
+    // Looks at the winners of the directories above path, top down. The
+    // first that is not a directory decides: a link hands the path to its
+    // archive's lookup, a file hides it. Returns false if none decides.
+    bool decide(const Table & t, std::string_view path, Hit & out) const {
+      uint64_t h = hashBasis;
+      for (size_t i = 0; i < path.size(); h = hash(h, path[i++])) {
+        if (path[i] != '/') continue;
+
+        Hit dir = find(t, path.substr(0, i), h);
+        if (!dir || dir.entry->isDirectory()) continue;
+
+        out = {};
+        if (dir.entry->isLink())
+          if (const Entry * e = dir.archive->lookup(path)) out = {dir.archive, e};
+        return true;
+      }
+      return false;
+    }
+
+    void insert(Table & t, uint32_t layer, uint32_t index) {
+      Hit hit = at(uint64_t(layer) << 32 | (index + 1));
+      std::string_view path = hit.archive->key(*hit.entry);
+      uint64_t h = hash(path), ref = uint64_t(layer) << 32 | (index + 1);
+
+      for (size_t s = h & (t.size - 1);; s = (s + 1) & (t.size - 1)) {
+        Slot & slot = t.slots[s];
+        uint64_t current = slot.ref.load(std::memory_order_relaxed);
+        if (!current) {
+          slot.hash.store(h, std::memory_order_relaxed);
+          slot.ref.store(ref, std::memory_order_release);
+          used++;
+          return;
+        }
+        if (slot.hash.load(std::memory_order_relaxed) != h) continue;
+
+        Hit other = at(current);
+        if (other.archive->key(*other.entry) != path) continue;
+        if (other.entry->isDirectory() != hit.entry->isDirectory()) masks.store(true, std::memory_order_release);
+        if (layers[current >> 32].load(std::memory_order_relaxed)->priority <= layers[layer].load(std::memory_order_relaxed)->priority)
+          slot.ref.store(ref, std::memory_order_release);
+        return;
+      }
+    }
+};
+
+using AsarOverlay = Asar::Overlay;
+
+// An archive compiled into the program and indexed by the compiler:
+//
+//   static constexpr unsigned char bytes[] = {
+//   #embed "assets.asar" // or the output of xxd -i
+//   };
+//   static constexpr AsarEmbedded<256> assets(bytes);
+//   constexpr auto logo = assets.find("img/logo.png"); // a constant
+//   std::string_view data = assets.view(logo);          // pointer arithmetic
+//
+// The header is parsed and a perfect hash of every path is built during
+// constant evaluation, so nothing is parsed at startup and a find() at run
+// time is one hash, one slot and one comparison. Capacity bounds the number
+// of entries (files and directories). An archive over capacity, a malformed
+// header or a name with escape sequences fails to compile (at run time, the
+// index is left empty). Links resolve to their targets, though not in the
+// middle of a path; unpacked entries are not found. Large headers may need
+// a higher -fconstexpr-ops-limit (GCC) or -fconstexpr-steps (Clang).
+template <size_t Capacity>
+class Asar::Embedded {
+  static_assert(Capacity > 0 && Capacity < (uint64_t(1) << 31), "capacity out of range");
+
+  public:
+    struct Location {
+      uint64_t offset = 0; // from the start of the archive bytes
+      uint64_t size = 0;
+      uint32_t flags = 0;
+      bool found = false;
+
+      constexpr explicit operator bool() const { return found; }
+      constexpr bool isDirectory() const { return flags & Directory; }
+      constexpr bool isExecutable() const { return flags & Executable; }
+    };
+
+    template <size_t N>
+    constexpr Embedded(const unsigned char (&bytes)[N]) : Embedded(bytes, N) {}
+
+    constexpr Embedded(const unsigned char * bytes, uint64_t size) : data(bytes), length(size) {
+      if (!load() || !index() || !resolve()) {
+        rejected();
+        count = 0;
+      }
+    }
+
+    constexpr size_t size() const { return count; }
+
+    constexpr Location find(std::string_view path) const {
+      size_t i = lookup([&](size_t k) { return path[k]; }, 0, path.size(), path.data());
+      if (i == npos || (nodes[i].flags & Link && !nodes[i].target)) return {};
+
+      const Node & node = nodes[nodes[i].flags & Link ? nodes[i].target - 1 : i];
+      if (node.flags & Unpacked) return {};
+      return {node.flags & Directory ? 0 : base + node.offset, node.size, node.flags, true};
+    }
+
+    constexpr bool exist(std::string_view path) const {
+      return bool(find(path));
+    }
+
+    std::string_view view(const Location & at) const {
+      if (!at || at.isDirectory()) return {};
+      return std::string_view((const char *)data + at.offset, at.size);
+    }
+
+    std::string_view view(std::string_view path) const {
+      return view(find(path));
+    }
+
+    std::string unpack(std::string_view path) const {
+      return std::string(view(path));
+    }
+
+  private:
+    static constexpr size_t npos = size_t(-1);
+
+    // Paths are not stored: a node has its name (a range of the header) and
+    // its parent, and the hash of the whole path.
+    struct Node {
+      uint64_t hash = 0;
+      uint64_t offset = 0; // for links: where the target is in the header
+      uint64_t size = 0;   // and its length
+      uint64_t name = 0;
+      uint64_t length = 0;
+      uint32_t parent = 0; // index + 1, 0 at the top level
+      uint32_t flags = 0;
+      uint32_t target = 0; // for links: index + 1 of where the chain ends, 0 if nowhere
+    };
+
+    static constexpr size_t round(size_t n) {
+      size_t size = 2;
+      while (size < n) size <<= 1;
+      return size;
+    }
+
+    // Twice as many slots as entries; a bucket of about four entries shares
+    // one seed, chosen so they all land in free slots.
+    static constexpr size_t tableSize = round(2 * Capacity);
+
+    static constexpr uint64_t mix(uint64_t h, uint64_t seed) {
+      h ^= seed * 0x9e3779b97f4a7c15ull;
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ull;
+      return h ^ (h >> 33);
+    }
+
+    const unsigned char * data;
+    uint64_t length;
+    uint64_t base = 0; // start of the file data
+    uint64_t end = 0;  // of the header
+    size_t count = 0;
+    size_t buckets = 1;
+    size_t mask = 1;
+    Node nodes[Capacity] = {};
+    uint32_t seeds[Capacity] = {};
+    uint32_t slots[tableSize] = {}; // index + 1
+
+    // Not constexpr: reaching it during constant evaluation is the compile
+    // error for an archive this class cannot index.
+    static void rejected() {}
+
+    constexpr bool load() {
+      if (length < 16) return false;
+      uint64_t pickle = le32(data + 4), size = le32(data + 12);
+      if (le32(data) != 4 || 16 + size > 8 + pickle || 8 + pickle > length) return false;
+      base = 8 + pickle;
+
+      uint64_t p = 16, at = 0, bytes = 0;
+      if (length >= base + 32 && trailer(data + length - 32, base, length - 32, at, bytes)) { p = at; size = bytes; }
+      end = p + size;
+
+      if (!consume(p, '{')) return false;
+      if (consume(p, '}')) return true;
+      do {
+        uint64_t key = 0, n = 0;
+        if (!string(p, key, n) || !consume(p, ':')) return false;
+        if (!(equals(key, n, "files") ? files(p, 0) : skip(p))) return false;
+      } while (consume(p, ','));
+      return consume(p, '}');
+    }
+
+    constexpr bool files(uint64_t & p, uint32_t parent) {
+      if (!consume(p, '{')) return false;
+      if (consume(p, '}')) return true;
+      do {
+        uint64_t name = 0, n = 0;
+        if (!string(p, name, n) || !n || !consume(p, ':') || count == Capacity) return false;
+
+        Node & node = nodes[count++];
+        node.parent = parent;
+        node.name = name;
+        node.length = n;
+        node.hash = parent ? hash(nodes[parent - 1].hash, '/') : hashBasis;
+        for (uint64_t k = name; k < name + n; k++) node.hash = hash(node.hash, data[k]);
+
+        if (!entry(p, count - 1)) return false;
+      } while (consume(p, ','));
+      return consume(p, '}');
+    }
+
+    constexpr bool entry(uint64_t & p, size_t i) {
+      if (!consume(p, '{')) return false;
+      if (consume(p, '}')) return true;
+
+      uint64_t link = 0, linkLength = 0;
+      do {
+        uint64_t key = 0, n = 0;
+        if (!string(p, key, n) || !consume(p, ':')) return false;
+
+        bool ok = true;
+        if (equals(key, n, "files")) { nodes[i].flags |= Directory; ok = files(p, i + 1); }
+        else if (equals(key, n, "size")) ok = number(p, nodes[i].size);
+        else if (equals(key, n, "offset")) {
+          uint64_t text = 0, digits = 0;
+          ok = string(p, text, digits);
+          uint64_t q = text;
+          ok = ok && number(q, nodes[i].offset) && q == text + digits;
+        }
+        else if (equals(key, n, "unpacked") || equals(key, n, "executable")) {
+          ws(p);
+          bool on = p < end && data[p] == 't';
+          if (on) nodes[i].flags |= equals(key, n, "unpacked") ? Unpacked : Executable;
+          ok = skip(p);
+        }
+        else if (equals(key, n, "link")) { nodes[i].flags |= Link; ok = string(p, link, linkLength); }
+        else ok = skip(p);
+        if (!ok) return false;
+      } while (consume(p, ','));
+
+      Node & node = nodes[i];
+      if (node.flags & Link) { node.offset = link; node.size = linkLength; }
+      else if (!(node.flags & (Directory | Unpacked)) && (node.offset > length - base || node.size > length - base - node.offset)) return false;
+      return consume(p, '}');
+    }
+
+    constexpr bool index() {
+      buckets = round(count / 4 + 1) / 2;
+      mask = round(2 * count) - 1;
+
+      // Entries grouped by bucket, then the buckets placed largest first.
+      uint32_t first[Capacity + 1] = {};
+      uint32_t order[Capacity] = {};
+      for (size_t i = 0; i < count; i++) first[(mix(nodes[i].hash, 0) & (buckets - 1)) + 1]++;
+      uint32_t largest = 0;
+      for (size_t b = 0; b < buckets; b++) {
+        largest = first[b + 1] > largest ? first[b + 1] : largest;
+        first[b + 1] += first[b];
+      }
+      uint32_t filled[Capacity] = {};
+      for (size_t i = 0; i < count; i++) {
+        size_t b = mix(nodes[i].hash, 0) & (buckets - 1);
+        order[first[b] + filled[b]++] = i;
+      }
+
+      for (uint32_t size = largest; size > 0; size--) {
+        for (size_t b = 0; b < buckets; b++) {
+          if (first[b + 1] - first[b] != size) continue;
+
+          // Equal paths could never be told apart.
+          for (uint32_t k = first[b]; k < first[b + 1]; k++)
+            for (uint32_t j = first[b]; j < k; j++)
+              if (nodes[order[j]].hash == nodes[order[k]].hash) return false;
+
+          uint32_t seed = 1;
+          for (; seed < (1u << 20); seed++) {
+            bool free = true;
+            for (uint32_t k = first[b]; free && k < first[b + 1]; k++) {
+              size_t slot = mix(nodes[order[k]].hash, seed) & mask;
+              free = !slots[slot];
+              for (uint32_t j = first[b]; free && j < k; j++) free = (mix(nodes[order[j]].hash, seed) & mask) != slot;
+            }
+            if (free) break;
+          }
+          if (seed == (1u << 20)) return false;
+
+          seeds[b] = seed;
+          for (uint32_t k = first[b]; k < first[b + 1]; k++) slots[mix(nodes[order[k]].hash, seed) & mask] = order[k] + 1;
+        }
+      }
+      return true;
+    }
+
+    // Follows every link to the entry its chain ends at, if it does.
+    constexpr bool resolve() {
+      for (size_t i = 0; i < count; i++) {
+        if (!(nodes[i].flags & Link)) continue;
+
+        size_t at = i;
+        for (unsigned hops = 0; at != npos && nodes[at].flags & Link; hops++) {
+          if (hops > maxHops) { at = npos; break; }
+          const Node & link = nodes[at];
+          at = lookup([&](size_t k) { return char(data[k]); }, link.offset, link.offset + link.size, nullptr);
+        }
+        nodes[i].target = at == npos ? 0 : at + 1;
+      }
+      return true;
+    }
+
+    // The node at path [begin, end) of text, normalized on the way like
+    // Asar::normalize(). chars, when given, holds the same characters as
+    // text, for comparing names with memcmp at run time.
+    template <typename Text>
+    constexpr size_t lookup(Text text, size_t begin, size_t end, const char * chars) const {
+      while (begin < end && text(begin) == '/') begin++;
+      while (end > begin && text(end - 1) == '/') end--;
+      if (!count || begin == end) return npos;
+
+      uint64_t h = hashBasis;
+      bool repeated = false;
+      for (size_t k = begin; k < end; k++) {
+        repeated |= text(k) == '/' && text(k - 1) == '/';
+        h = hash(h, text(k));
+      }
+      if (repeated) {
+        h = hashBasis;
+        for (size_t k = begin; k < end; k++)
+          if (text(k) != '/' || text(k - 1) != '/') h = hash(h, text(k));
+      }
+
+      uint32_t slot = slots[mix(h, seeds[mix(h, 0) & (buckets - 1)]) & mask];
+      if (!slot || nodes[slot - 1].hash != h) return npos;
+
+      // From the last component up through the parents.
+      for (size_t i = slot; i; i = nodes[i - 1].parent) {
+        const Node & node = nodes[i - 1];
+        if (end - begin < node.length) return npos;
+#ifdef ASAR_CONSTANT_EVALUATED
+        if (chars && !__builtin_is_constant_evaluated()) {
+          if (std::memcmp(chars + end - node.length, data + node.name, node.length)) return npos;
+        } else
+#endif
+        for (uint64_t k = 0; k < node.length; k++)
+          if (text(end - node.length + k) != char(data[node.name + k])) return npos;
+        end -= node.length;
+
+        if (node.parent) {
+          if (end == begin || text(end - 1) != '/') return npos;
+          while (end > begin && text(end - 1) == '/') end--;
+        }
+      }
+      return end == begin ? slot - 1 : npos;
+    }
+
+    static constexpr bool space(unsigned char c) {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    constexpr void ws(uint64_t & p) const {
+      while (p < end && space(data[p])) p++;
+    }
+
+    constexpr bool consume(uint64_t & p, char c) const {
+      ws(p);
+      if (p >= end || data[p] != uint8_t(c)) return false;
+      p++;
+      return true;
+    }
+
+    // Names, keys, offsets and link targets; escapes are not supported.
+    constexpr bool string(uint64_t & p, uint64_t & at, uint64_t & n) const {
+      if (!consume(p, '"')) return false;
+      at = p;
+      while (p < end && data[p] != '"' && data[p] != '\\') p++;
+      if (p >= end || data[p] != '"') return false;
+      n = p++ - at;
+      return true;
+    }
+
+    constexpr bool number(uint64_t & p, uint64_t & out) const {
+      ws(p);
+      uint64_t start = p;
+      out = 0;
+      for (; p < end && data[p] >= '0' && data[p] <= '9'; p++) {
+        if (out > (std::numeric_limits<uint64_t>::max() - 9) / 10) return false;
+        out = out * 10 + (data[p] - '0');
+      }
+      return p > start;
+    }
+
+    constexpr bool equals(uint64_t at, uint64_t n, const char * text) const {
+      for (uint64_t k = 0; k < n; k++)
+        if (!text[k] || data[at + k] != uint8_t(text[k])) return false;
+      return !text[n];
+    }
+
+    // Any JSON value, by matching brackets outside strings.
+    constexpr bool skip(uint64_t & p) const {
+      ws(p);
+      uint64_t depth = 0;
+      do {
+        if (p >= end) return false;
+        unsigned char c = data[p++];
+        if (c == '"') {
+          while (p < end && data[p] != '"') p += data[p] == '\\' ? 2 : 1;
+          if (p++ >= end) return false;
+        }
+        else if (c == '{' || c == '[') depth++;
+        else if (c == '}' || c == ']') { if (!depth--) return false; }
+        else if (!depth) {
+          while (p < end && data[p] != ',' && data[p] != '}' && data[p] != ']' && !space(data[p])) p++;
+        }
+      } while (depth);
+      return true;
+    }
+};
+
+template <size_t Capacity>
+using AsarEmbedded = Asar::Embedded<Capacity>;
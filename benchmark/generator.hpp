@@ -0,0 +1,223 @@
+#pragma once
+
+#include "../sha256.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Writes reproducible synthetic archives: the same Options always produce
+// the same bytes.
+namespace generator {
+  enum class Sizes { Empty, Small, Mixed };
+
+  struct Options {
+    uint64_t entries = 10000;  // files; directories come on top
+    unsigned depth = 3;        // directory levels above every file
+    unsigned nameLength = 12;  // average component length
+    Sizes sizes = Sizes::Small;
+    bool integrity = false;    // SHA-256 block hashes, as electron writes them
+    uint64_t seed = 1;
+  };
+
+  struct Archive {
+    std::vector<std::string> files; // normalized paths
+    std::vector<std::string> large; // subset of files, Sizes::Mixed only
+    uint64_t directories = 0;
+    uint64_t dataSize = 0;
+    uint64_t headerSize = 0;
+  };
+
+  static constexpr uint64_t blockSize = 4 << 20;
+
+  namespace {
+    struct Node {
+      std::map<std::string, Node> children;
+      uint64_t size = 0, offset = 0;
+      bool file = false;
+      std::string digest;
+      std::vector<std::string> blocks;
+    };
+
+    // File contents are windows of one random pool, so they are cheap to
+    // produce twice (once to hash, once to write).
+    const std::vector<char> & pool() {
+      static const std::vector<char> bytes = [] {
+        std::vector<char> out(1 << 20);
+        std::mt19937_64 random(42);
+        for (auto & c : out) c = char(random());
+        return out;
+      }();
+      return bytes;
+    }
+
+    void content(uint64_t offset, char * out, uint64_t size) {
+      const std::vector<char> & bytes = pool();
+      while (size) {
+        uint64_t at = offset % bytes.size(), n = std::min<uint64_t>(size, bytes.size() - at);
+        std::copy(bytes.data() + at, bytes.data() + at + n, out);
+        out += n; offset += n; size -= n;
+      }
+    }
+
+    std::string hex(const uint8_t digest[32]) {
+      static const char * digits = "0123456789abcdef";
+      std::string out;
+      for (int i = 0; i < 32; i++) { out += digits[digest[i] >> 4]; out += digits[digest[i] & 15]; }
+      return out;
+    }
+
+    void hash(Node & node) {
+      std::vector<char> bytes(node.size);
+      content(node.offset, bytes.data(), node.size);
+
+      uint8_t digest[32];
+      sha256::digest(bytes.data(), bytes.size(), digest);
+      node.digest = hex(digest);
+
+      // Like Electron's packer, the rest after the last full block is
+      // hashed even when it is empty.
+      for (uint64_t at = 0; at <= node.size; at += blockSize) {
+        uint64_t n = std::min<uint64_t>(blockSize, node.size - at);
+        sha256::digest(bytes.data() + at, n, digest);
+        node.blocks.push_back(hex(digest));
+      }
+    }
+
+    void json(const Node & dir, std::string & out) {
+      out += "{\"files\":{";
+      bool first = true;
+      for (auto & child : dir.children) {
+        if (!first) out += ',';
+        first = false;
+        out += '"' + child.first + "\":";
+
+        const Node & node = child.second;
+        if (!node.file) { json(node, out); continue; }
+
+        out += "{\"size\":" + std::to_string(node.size) + ",\"offset\":\"" + std::to_string(node.offset) + '"';
+        if (!node.digest.empty()) {
+          out += ",\"integrity\":{\"algorithm\":\"SHA256\",\"hash\":\"" + node.digest + "\",\"blockSize\":" +
+            std::to_string(blockSize) + ",\"blocks\":[";
+          for (size_t i = 0; i < node.blocks.size(); i++) out += (i ? ",\"" : "\"") + node.blocks[i] + '"';
+          out += "]}";
+        }
+        out += '}';
+      }
+      out += "}}";
+    }
+
+    void le32(std::string & out, uint32_t v) {
+      for (int i = 0; i < 4; i++) out += char(v >> (i * 8));
+    }
+  }
+
+  // Directory names carry no '.', file names always do, so the json.hpp
+  // baseline (which guesses directories by the missing dot) can read them.
+  inline Archive generate(const std::string & path, const Options & options) {
+    std::mt19937_64 random(options.seed);
+    Archive archive;
+    Node root;
+
+    uint64_t fanout = 2;
+    while (options.depth && std::pow(double(fanout), options.depth) * 16 < options.entries) fanout++;
+
+    auto name = [&](bool file) {
+      static const char * extensions[] = {".js", ".css", ".png", ".json", ".html"};
+      unsigned length = std::max<unsigned>(1, options.nameLength / 2 + random() % (options.nameLength + 1));
+      std::string out;
+      for (unsigned i = 0; i < length; i++) out += char('a' + random() % 26);
+      if (file) out += extensions[random() % 5];
+      return out;
+    };
+
+    // Directory names are drawn per (level, slot) so siblings collide into
+    // shared directories instead of fanning out per file.
+    std::vector<std::vector<std::string>> levels(options.depth);
+    for (auto & level : levels)
+      for (uint64_t i = 0; i < fanout; i++) level.push_back(name(false) + std::to_string(i));
+
+    uint64_t large = options.sizes == Sizes::Mixed ? std::min<uint64_t>(8, std::max<uint64_t>(1, options.entries / 100)) : 0;
+
+    for (uint64_t i = 0; i < options.entries; i++) {
+      std::string full;
+      Node * dir = &root;
+      for (unsigned level = 0; level < options.depth; level++) {
+        const std::string & component = levels[level][random() % fanout];
+        Node & next = dir->children[component];
+        if (next.children.empty()) archive.directories++;
+        dir = &next;
+        full += component + '/';
+      }
+
+      std::string file;
+      do file = name(true) + std::to_string(i); while (dir->children.count(file));
+      Node & node = dir->children[file];
+      node.file = true;
+      full += file;
+
+      switch (options.sizes) {
+        case Sizes::Empty: node.size = 0; break;
+        case Sizes::Small: // log-uniform, 64 B to 16 KiB
+        case Sizes::Mixed: node.size = uint64_t(64 * std::pow(256.0, std::uniform_real_distribution<double>()(random))); break;
+      }
+      if (i < large) {
+        node.size = (16 + random() % 48) << 20; // 16 to 64 MiB
+        archive.large.push_back(full);
+      }
+
+      archive.files.push_back(full);
+    }
+
+    // Offsets in path order, like electron's packer lays files out.
+    std::vector<Node *> order;
+    std::vector<Node *> stack{&root};
+    while (!stack.empty()) {
+      Node * node = stack.back();
+      stack.pop_back();
+      if (node->file) { order.push_back(node); continue; }
+      for (auto i = node->children.rbegin(); i != node->children.rend(); ++i) stack.push_back(&i->second);
+    }
+
+    for (Node * node : order) {
+      node->offset = archive.dataSize;
+      archive.dataSize += node->size;
+      if (options.integrity) hash(*node);
+    }
+
+    // Pickle framing: [4][header pickle size][payload size][string size][json]
+    std::string text;
+    json(root, text);
+    uint32_t length = text.size(), padded = (length + 3) & ~3u;
+    text.resize(padded, '\0');
+    archive.headerSize = length;
+
+    std::string prefix;
+    le32(prefix, 4);
+    le32(prefix, padded + 8);
+    le32(prefix, padded + 4);
+    le32(prefix, length);
+
+    FILE * out = std::fopen(path.c_str(), "wb");
+    if (!out) return Archive();
+
+    std::fwrite(prefix.data(), 1, prefix.size(), out);
+    std::fwrite(text.data(), 1, text.size(), out);
+
+    std::vector<char> buffer(1 << 20);
+    for (Node * node : order) {
+      for (uint64_t at = 0; at < node->size; at += buffer.size()) {
+        uint64_t n = std::min<uint64_t>(buffer.size(), node->size - at);
+        content(node->offset + at, buffer.data(), n);
+        std::fwrite(buffer.data(), 1, n, out);
+      }
+    }
+
+    if (std::fclose(out) != 0) return Archive();
+    return archive;
+  }
+} // End Namespace generator
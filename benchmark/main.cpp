@@ -0,0 +1,735 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include "../asar.hpp"
+#include "baseline.hpp"
+#include "generator.hpp"
+
+#include <sys/resource.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Benchmarks for Asar against generated archives. Every measurement is one
+// JSON object per line on stdout (progress goes to stderr), so runs can be
+// collected and compared across commits:
+//
+//   ./benchmark --entries 1000,100000 --sizes mixed --label $(git rev-parse --short HEAD) > results.jsonl
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  struct Settings {
+    std::vector<uint64_t> entries{1000, 10000, 100000};
+    std::vector<unsigned> threads;
+    generator::Options options;
+    std::string directory = "/tmp";
+    std::string label;
+    std::string only;
+    std::string generate;
+    std::string packer; // external packer to compare with, e.g. "npx @electron/asar"
+    uint64_t baselineLimit = 100000; // the json.hpp reader gets slow and large beyond this
+    unsigned runs = 5;
+    bool keep = false;
+  } settings;
+
+  const char * sizes(generator::Sizes s) {
+    return s == generator::Sizes::Empty ? "empty" : s == generator::Sizes::Small ? "small" : "mixed";
+  }
+
+  void report(const std::string & benchmark, const std::string & variant, const std::string & metric, double value, const char * unit, unsigned threads = 1) {
+    const generator::Options & o = settings.options;
+    std::printf("{\"label\":\"%s\",\"entries\":%llu,\"depth\":%u,\"name\":%u,\"sizes\":\"%s\",\"integrity\":%s,"
+      "\"benchmark\":\"%s\",\"variant\":\"%s\",\"metric\":\"%s\",\"threads\":%u,\"value\":%.6g,\"unit\":\"%s\"}\n",
+      settings.label.c_str(), (unsigned long long)o.entries, o.depth, o.nameLength, sizes(o.sizes), o.integrity ? "true" : "false",
+      benchmark.c_str(), variant.c_str(), metric.c_str(), threads, value, unit);
+    std::fflush(stdout);
+  }
+
+  bool enabled(const char * benchmark) {
+    if (settings.only.empty()) return true;
+    std::stringstream list(settings.only);
+    for (std::string item; std::getline(list, item, ',');)
+      if (item == benchmark) return true;
+    return false;
+  }
+
+  double milliseconds(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  }
+
+  double seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+  }
+
+  // Peak RSS is read from /proc; writing 5 to clear_refs resets the peak, so
+  // each variant gets its own high-water mark. Freed heap is handed back
+  // first, or reusing it would hide the growth.
+  uint64_t status(const char * field) {
+    std::ifstream in("/proc/self/status");
+    for (std::string line; std::getline(in, line);)
+      if (line.compare(0, std::strlen(field), field) == 0) return std::strtoull(line.c_str() + std::strlen(field) + 1, nullptr, 10);
+    return 0;
+  }
+
+  void resetPeak() {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    std::ofstream("/proc/self/clear_refs") << "5";
+  }
+
+  // Evicts the archive from the page cache (its pages are clean, so no
+  // privileges are needed).
+  void dropCache(const std::string & file) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+  }
+
+  // An Asar reading through pread(), as when the archive does not fit the
+  // address space: the soft RLIMIT_AS leaves too little room for the
+  // mapping while the constructor runs. Null if that leaves too little
+  // for the index as well.
+  std::unique_ptr<Asar> unmapped(const std::string & file) {
+    rlimit old, low;
+    if (getrlimit(RLIMIT_AS, &old)) return nullptr;
+    low = old;
+    low.rlim_cur = std::min<rlim_t>(old.rlim_cur, status("VmSize:") * 1024 + std::filesystem::file_size(file) - 1);
+    if (setrlimit(RLIMIT_AS, &low)) return nullptr;
+
+    std::unique_ptr<Asar> asar;
+    try { asar.reset(new Asar(file)); } catch (const std::bad_alloc &) {}
+    setrlimit(RLIMIT_AS, &old);
+    return asar;
+  }
+
+  template <typename F>
+  double median(unsigned runs, F f) {
+    std::vector<double> times;
+    for (unsigned i = 0; i < runs; i++) times.push_back(f());
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+  }
+
+  std::vector<std::string> sample(const std::vector<std::string> & from, size_t count, uint64_t seed) {
+    std::mt19937_64 random(seed);
+    std::vector<std::string> out;
+    if (from.empty()) return out;
+    for (size_t i = 0; i < count; i++) out.push_back(from[random() % from.size()]);
+    return out;
+  }
+
+  // Open cost, time to the first unpack and the memory each reader keeps.
+  void open(const std::string & file, const generator::Archive & archive) {
+    std::string index = file + ".idx";
+    { Asar warm(file, index); }
+
+    const std::string & first = archive.files[archive.files.size() / 2];
+    bool baseline = settings.options.entries <= settings.baselineLimit;
+
+    auto measure = [&](const char * variant, auto make) {
+      double open = median(settings.runs, [&] {
+        auto start = Clock::now();
+        auto reader = make();
+        return milliseconds(Clock::now() - start);
+      });
+      double unpack = median(settings.runs, [&] {
+        auto start = Clock::now();
+        auto reader = make();
+        reader->unpack(first);
+        return milliseconds(Clock::now() - start);
+      });
+
+      resetPeak();
+      uint64_t before = status("VmRSS:");
+      auto reader = make();
+      uint64_t peak = status("VmHWM:");
+
+      report("open", variant, "time", open, "ms");
+      report("first_unpack", variant, "time", unpack, "ms");
+      report("open", variant, "peak_rss", double(peak > before ? peak - before : 0), "KiB");
+    };
+
+    if (baseline) measure("baseline", [&] { return std::make_unique<Baseline>(file); });
+    measure("eager", [&] { return std::make_unique<Asar>(file); });
+    measure("lazy", [&] { return std::make_unique<Asar>(file, Asar::Load::Lazy); });
+    measure("index", [&] { return std::make_unique<Asar>(file, index); });
+
+    std::remove(index.c_str());
+  }
+
+  // Mean and percentiles of find() over paths, reported as name. Each call
+  // is timed on its own; the cost of reading the clock is measured up front
+  // and subtracted.
+  template <typename F>
+  void latency(const std::string & name, const char * variant, const std::vector<std::string> & paths, F && find) {
+    static const double overhead = [] {
+      std::vector<double> clock(10000);
+      for (auto & t : clock) { auto a = Clock::now(); t = std::chrono::duration<double, std::nano>(Clock::now() - a).count(); }
+      std::sort(clock.begin(), clock.end());
+      return clock[clock.size() / 2];
+    }();
+
+    std::vector<double> times(paths.size());
+    size_t found = 0;
+
+    auto start = Clock::now();
+    for (auto & path : paths) found += find(path);
+    double mean = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / paths.size();
+
+    for (size_t i = 0; i < paths.size(); i++) {
+      auto a = Clock::now();
+      found += find(paths[i]);
+      times[i] = std::max(0.0, std::chrono::duration<double, std::nano>(Clock::now() - a).count() - overhead);
+    }
+    std::sort(times.begin(), times.end());
+
+    report(name, variant, "mean", mean, "ns");
+    for (double p : {0.5, 0.9, 0.99, 0.999}) {
+      char metric[16];
+      std::snprintf(metric, sizeof metric, "p%g", p * 100);
+      report(name, variant, metric, times[size_t(p * (times.size() - 1))], "ns");
+    }
+    volatile size_t sink = found; // keeps the lookups from being optimized out
+    (void)sink;
+  }
+
+  // Lookup latency percentiles, hits and misses.
+  void lookup(const std::string & file, const generator::Archive & archive) {
+    size_t count = std::min<size_t>(200000, archive.files.size() * 4);
+    std::vector<std::string> hits = sample(archive.files, count, 2), misses = hits;
+    for (auto & path : misses) path.back() = '#';
+
+    auto measure = [&](const char * variant, const char * kind, const std::vector<std::string> & paths, auto && find) {
+      latency(std::string("lookup_") + kind, variant, paths, find);
+    };
+
+    Asar eager(file);
+    measure("eager", "hit", hits, [&](const std::string & p) { return eager.resolve(p) != nullptr; });
+    measure("eager", "miss", misses, [&](const std::string & p) { return eager.resolve(p) != nullptr; });
+
+    // Starts cold, so the first lookups into each directory pay for its parse.
+    Asar lazy(file, Asar::Load::Lazy);
+    measure("lazy", "hit", hits, [&](const std::string & p) { return lazy.resolve(p) != nullptr; });
+    measure("lazy", "miss", misses, [&](const std::string & p) { return lazy.resolve(p) != nullptr; });
+
+    if (settings.options.entries <= settings.baselineLimit) {
+      Baseline baseline(file);
+      measure("baseline", "hit", hits, [&](const std::string & p) { return baseline.exist(p); });
+      measure("baseline", "miss", misses, [&](const std::string & p) { return baseline.exist(p); });
+    }
+  }
+
+  // Small-file throughput, warm and with the archive evicted from the page
+  // cache, one call per file and batched through unpackMany(): random
+  // batches, and nearby ones (runs of neighbours in archive order, as the
+  // assets of one page tend to be), which is where reads coalesce.
+  void small(const std::string & file, const generator::Archive & archive) {
+    std::vector<std::string> files;
+    for (auto & path : archive.files)
+      if (std::find(archive.large.begin(), archive.large.end(), path) == archive.large.end()) files.push_back(path);
+
+    std::vector<std::string> paths = sample(files, std::min<size_t>(100000, files.size()), 3);
+    if (paths.empty()) return;
+
+    std::vector<std::string> sorted = files, nearby;
+    std::sort(sorted.begin(), sorted.end()); // path order is archive order
+    std::vector<size_t> runs;
+    for (size_t i = 0; i < sorted.size(); i += 256) runs.push_back(i);
+    std::shuffle(runs.begin(), runs.end(), std::mt19937_64(4));
+    for (size_t i = 0; nearby.size() < paths.size(); i = (i + 1) % runs.size())
+      for (size_t k = runs[i]; k < std::min(sorted.size(), runs[i] + 256); k++) nearby.push_back(sorted[k]);
+
+    Asar asar(file);
+    const Asar * reader = &asar;
+    auto run = [&](const std::string & variant, auto && body, size_t count) {
+      uint64_t bytes = 0;
+      auto start = Clock::now();
+      body(bytes, count);
+      double s = seconds(Clock::now() - start);
+      report("small_unpack", variant, "throughput", bytes / s / (1 << 20), "MiB/s");
+      report("small_unpack", variant, "rate", count / s, "files/s");
+    };
+
+    auto single = [&](uint64_t & bytes, size_t count) {
+      for (size_t i = 0; i < count; i++) bytes += reader->unpack(paths[i]).size();
+    };
+    auto many = [&](const std::vector<std::string> & list) {
+      return [&](uint64_t & bytes, size_t count) {
+        std::vector<std::string_view> batch;
+        for (size_t i = 0; i < count; i += 256) {
+          batch.assign(list.begin() + i, list.begin() + std::min(count, i + 256));
+          for (auto & data : reader->unpackMany(batch)) bytes += data.size();
+        }
+      };
+    };
+    auto view = [&](uint64_t & bytes, size_t count) {
+      for (size_t i = 0; i < count; i++) {
+        std::string_view data = asar.view(paths[i]);
+        for (size_t at = 0; at < data.size(); at += 4096) bytes += data[at] & 0; // fault the pages in
+        bytes += data.size();
+      }
+    };
+
+    uint64_t warm = 0;
+    single(warm, paths.size()); // fills the page cache
+    run("unpack", single, paths.size());
+    run("unpackMany", many(paths), paths.size());
+    run("unpackMany_nearby", many(nearby), paths.size());
+    run("view", view, paths.size());
+
+    size_t cold = std::min<size_t>(20000, paths.size());
+    dropCache(file);
+    run("unpack_cold", single, cold);
+    dropCache(file);
+    run("unpackMany_cold", many(paths), cold);
+    dropCache(file);
+    run("unpackMany_nearby_cold", many(nearby), cold);
+
+    // Without the mapping: pread() per file against the vectored reads.
+    std::unique_ptr<Asar> plain = unmapped(file);
+    if (plain && !plain->view(paths[0]).data()) {
+      reader = plain.get();
+      single(warm, paths.size());
+      run("unpack_unmapped", single, paths.size());
+      run("unpackMany_unmapped", many(paths), paths.size());
+      run("unpackMany_nearby_unmapped", many(nearby), paths.size());
+      dropCache(file);
+      run("unpack_unmapped_cold", single, cold);
+      dropCache(file);
+      run("unpackMany_unmapped_cold", many(paths), cold);
+      dropCache(file);
+      run("unpackMany_nearby_unmapped_cold", many(nearby), cold);
+    }
+
+    if (settings.options.entries <= settings.baselineLimit) {
+      Baseline baseline(file);
+      run("baseline", [&](uint64_t & bytes, size_t count) {
+        for (size_t i = 0; i < count; i++) bytes += baseline.unpack(paths[i]).size();
+      }, std::min<size_t>(20000, paths.size()));
+    }
+  }
+
+  // Large files: a whole copy, streaming through a Reader, and the mapping.
+  void large(const std::string & file, const generator::Archive & archive) {
+    if (archive.large.empty()) return;
+    Asar asar(file);
+
+    auto run = [&](const char * variant, auto && body) {
+      uint64_t bytes = 0;
+      auto start = Clock::now();
+      for (auto & path : archive.large) bytes += body(path);
+      report("large_unpack", variant, "throughput", bytes / seconds(Clock::now() - start) / (1 << 20), "MiB/s");
+    };
+
+    run("unpack", [&](const std::string & path) { return asar.unpack(path).size(); });
+    run("reader", [&](const std::string & path) {
+      std::vector<char> buffer(1 << 20);
+      Asar::Reader reader = asar.open(path);
+      uint64_t total = 0;
+      while (size_t n = reader.read(buffer.data(), buffer.size())) total += n;
+      return total;
+    });
+    run("view", [&](const std::string & path) {
+      std::string_view data = asar.view(path);
+      volatile char sink = 0;
+      for (size_t at = 0; at < data.size(); at += 4096) sink = sink + data[at];
+      return data.size();
+    });
+  }
+
+  // 64 KiB Range requests into large entries: slicing a full unpack(),
+  // read() of just the range, and sendTo() a descriptor (/dev/null, so only
+  // the archive side of the transfer is measured).
+  void range(const std::string & file, const generator::Archive & archive) {
+    if (archive.large.empty()) return;
+    static constexpr uint64_t window = 64 << 10;
+    Asar asar(file);
+    int null = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    std::mt19937_64 random(8);
+    std::vector<std::pair<std::string, uint64_t>> requests;
+    for (int i = 0; i < 64; i++) {
+      const std::string & path = archive.large[random() % archive.large.size()];
+      requests.emplace_back(path, random() % (asar.resolve(path)->size - window));
+    }
+
+    auto run = [&](const char * variant, auto && body) {
+      auto start = Clock::now();
+      for (auto & request : requests) body(request.first, request.second);
+      report("range", variant, "time", seconds(Clock::now() - start) * 1e6 / requests.size(), "us");
+    };
+
+    run("unpack", [&](const std::string & path, uint64_t from) { return asar.unpack(path).substr(from, window).size(); });
+    run("read", [&](const std::string & path, uint64_t from) { return asar.read(path, from, window).size(); });
+    run("send", [&](const std::string & path, uint64_t from) { return asar.sendTo(path, null, from, window); });
+    ::close(null);
+  }
+
+  void extract(const std::string & file, const generator::Archive & archive) {
+    std::string destination = file + ".extract";
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    Asar asar(file);
+
+    for (bool cold : {false, true}) {
+      std::filesystem::remove_all(destination);
+      if (cold) dropCache(file);
+
+      auto start = Clock::now();
+      bool ok = asar.extractAll(destination, threads);
+      double s = seconds(Clock::now() - start);
+
+      if (!ok) std::cerr << "extractAll failed\n";
+      report("extract", cold ? "cold" : "warm", "throughput", archive.dataSize / s / (1 << 20), "MiB/s", threads);
+      report("extract", cold ? "cold" : "warm", "rate", archive.files.size() / s, "files/s", threads);
+    }
+
+    std::filesystem::remove_all(destination);
+  }
+
+  void verify(const std::string & file, const generator::Archive & archive) {
+    if (!settings.options.integrity) return;
+    Asar asar(file);
+
+    for (unsigned threads : settings.threads) {
+      auto start = Clock::now();
+      bool ok = asar.verifyAll(threads);
+      double s = seconds(Clock::now() - start);
+      if (!ok) std::cerr << "verifyAll failed\n";
+      report("verify", "verifyAll", "throughput", archive.dataSize / s / (1 << 20), "MiB/s", threads);
+    }
+  }
+
+  // Packing the extracted archive back up, with and without integrity
+  // hashing, and optionally with an external packer for comparison.
+  void pack(const std::string & file, const generator::Archive & archive) {
+    std::string tree = file + ".tree", output = file + ".packed";
+    std::filesystem::remove_all(tree);
+    if (!Asar(file).extractAll(tree)) { std::cerr << "extractAll failed\n"; return; }
+
+    for (unsigned threads : settings.threads) {
+      for (bool integrity : {true, false}) {
+        auto start = Clock::now();
+        AsarWriter writer(integrity);
+        bool ok = writer.addTree(tree) && writer.write(output, threads);
+        double s = seconds(Clock::now() - start);
+
+        if (!ok) std::cerr << "AsarWriter failed\n";
+        report("pack", integrity ? "writer_integrity" : "writer", "throughput", archive.dataSize / s / (1 << 20), "MiB/s", threads);
+        report("pack", integrity ? "writer_integrity" : "writer", "rate", archive.files.size() / s, "files/s", threads);
+      }
+    }
+
+    if (!settings.packer.empty()) {
+      std::string command = settings.packer + " pack '" + tree + "' '" + output + "' > /dev/null";
+      auto start = Clock::now();
+      int status = std::system(command.c_str());
+      double s = seconds(Clock::now() - start);
+
+      if (status != 0) std::cerr << "external packer failed\n";
+      report("pack", "external", "throughput", archive.dataSize / s / (1 << 20), "MiB/s");
+      report("pack", "external", "rate", archive.files.size() / s, "files/s");
+    }
+
+    std::filesystem::remove_all(tree);
+    std::remove(output.c_str());
+  }
+
+  // A warm start after a cold boot: the same few hundred reads, with and
+  // without replaying a recorded access profile first.
+  void profile(const std::string & file, const generator::Archive & archive) {
+    std::vector<std::string> paths = sample(archive.files, std::min<size_t>(500, archive.files.size()), 5);
+    std::string recorded = file + ".profile";
+    {
+      Asar asar(file);
+      asar.recordProfile(recorded);
+      for (auto & path : paths) asar.unpack(path);
+    }
+
+    for (bool replay : {false, true}) {
+      dropCache(file);
+      auto start = Clock::now();
+      Asar asar(file);
+      if (replay) asar.prefetch(recorded);
+
+      uint64_t bytes = 0;
+      for (auto & path : paths) bytes += asar.unpack(path).size();
+      report("profile", replay ? "prefetch" : "cold", "time", milliseconds(Clock::now() - start), "ms");
+    }
+
+    std::remove(recorded.c_str());
+  }
+
+  // The same cold start before and after repacking the archive so the
+  // profiled entries sit together, in the order they are first read.
+  void repack(const std::string & file, const generator::Archive & archive) {
+    std::vector<std::string> paths = sample(archive.files, std::min<size_t>(500, archive.files.size()), 5);
+    std::string recorded = file + ".profile", repacked = file + ".repacked";
+    {
+      Asar asar(file);
+      asar.recordProfile(recorded);
+      for (auto & path : paths) asar.unpack(path);
+    }
+
+    auto start = Clock::now();
+    if (!Asar(file).repack(repacked, recorded)) { std::cerr << "repack failed\n"; return; }
+    report("repack", "write", "time", milliseconds(Clock::now() - start), "ms");
+
+    for (bool after : {false, true}) {
+      const std::string & target = after ? repacked : file;
+      dropCache(target);
+      start = Clock::now();
+      Asar asar(target);
+
+      uint64_t bytes = 0;
+      for (auto & path : paths) bytes += asar.unpack(path).size();
+      report("repack", after ? "after" : "before", "time", milliseconds(Clock::now() - start), "ms");
+    }
+
+    std::remove(recorded.c_str());
+    std::remove(repacked.c_str());
+  }
+
+  // A base archive under a stack of small patch archives: probing one Asar
+  // per layer, top down, against the merged index of an AsarOverlay. Base
+  // hits and misses are the worst case for the chain, which asks every
+  // layer first.
+  void overlay(const std::string & file, const generator::Archive & archive) {
+    static constexpr unsigned patches = 4;
+
+    generator::Options options = settings.options;
+    options.entries = std::max<uint64_t>(100, options.entries / 100);
+    std::vector<std::string> files;
+    for (unsigned i = 0; i < patches; i++) {
+      options.seed = settings.options.seed + 1000 + i;
+      files.push_back(file + ".patch" + std::to_string(i));
+      generator::generate(files.back(), options);
+    }
+
+    size_t count = std::min<size_t>(200000, archive.files.size() * 4);
+    std::vector<std::string> hits = sample(archive.files, count, 6), misses = hits;
+    for (auto & path : misses) path.back() = '#';
+
+    std::vector<std::unique_ptr<Asar>> chain;
+    for (auto i = files.rbegin(); i != files.rend(); ++i) chain.emplace_back(new Asar(*i));
+    chain.emplace_back(new Asar(file));
+    auto find = [&](const std::string & path) {
+      for (auto & layer : chain)
+        if (layer->exist(path)) return true;
+      return false;
+    };
+    latency("overlay_hit", "chain", hits, find);
+    latency("overlay_miss", "chain", misses, find);
+
+    AsarOverlay merged;
+    auto start = Clock::now();
+    merged.mount(file, 0);
+    report("overlay", "mount", "base", milliseconds(Clock::now() - start), "ms");
+    start = Clock::now();
+    for (unsigned i = 0; i < patches; i++) merged.mount(files[i], i + 1);
+    report("overlay", "mount", "patches", milliseconds(Clock::now() - start), "ms");
+
+    latency("overlay_hit", "merged", hits, [&](const std::string & path) { return bool(merged.resolve(path)); });
+    latency("overlay_miss", "merged", misses, [&](const std::string & path) { return bool(merged.resolve(path)); });
+
+    for (auto & patch : files) std::remove(patch.c_str());
+  }
+
+  // Changing a handful of entries: appended in place by AsarUpdater, against
+  // writing the whole archive again (compact() of the result, which copies
+  // every live entry and the header).
+  void update(const std::string & file, const generator::Archive & archive) {
+    std::vector<std::string> paths = sample(archive.files, std::min<size_t>(10, archive.files.size()), 7);
+    std::string updated = file + ".updated", compacted = file + ".compacted";
+    std::filesystem::copy_file(file, updated, std::filesystem::copy_options::overwrite_existing);
+
+    AsarUpdater updater(updated, settings.options.integrity);
+    for (auto & path : paths) updater.addData(path, std::string(4096, 'u'));
+    auto start = Clock::now();
+    if (!updater.write()) { std::cerr << "update failed\n"; return; }
+    report("update", "append", "time", milliseconds(Clock::now() - start), "ms");
+    report("update", "append", "growth", double(std::filesystem::file_size(updated) - std::filesystem::file_size(file)), "bytes");
+
+    start = Clock::now();
+    if (!Asar(updated).compact(compacted)) { std::cerr << "compact failed\n"; return; }
+    report("update", "rewrite", "time", milliseconds(Clock::now() - start), "ms");
+
+    std::remove(updated.c_str());
+    std::remove(compacted.c_str());
+  }
+
+  // An archive already in memory: opened as an Asar, which parses the header
+  // at startup, against an AsarEmbedded, whose perfect-hash index a program
+  // would get from the compiler (built at run time here, so that generated
+  // archives can be measured). Both resolve the same paths.
+  void embedded(const std::string & file, const generator::Archive & archive) {
+    static constexpr size_t capacity = 1 << 16;
+    std::ifstream in(file, std::ios::binary);
+    std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    auto start = Clock::now();
+    Asar memory(Asar::Memory{bytes.data(), bytes.size()});
+    report("embedded", "asar", "open", milliseconds(Clock::now() - start), "ms");
+
+    if (archive.files.size() + archive.directories > capacity) return;
+    start = Clock::now();
+    std::unique_ptr<AsarEmbedded<capacity>> index(new AsarEmbedded<capacity>(bytes.data(), bytes.size()));
+    if (!index->size()) { std::cerr << "embedded index failed\n"; return; }
+    report("embedded", "embedded", "index", milliseconds(Clock::now() - start), "ms");
+
+    std::vector<std::string> paths = sample(archive.files, std::min<size_t>(200000, archive.files.size() * 4), 9);
+    latency("embedded_lookup", "asar", paths, [&](const std::string & path) { return bool(memory.resolve(path)); });
+    latency("embedded_lookup", "embedded", paths, [&](const std::string & path) { return bool(index->find(path)); });
+  }
+
+  // The same fixed amount of work spread over more and more threads.
+  void scaling(const std::string & file, const generator::Archive & archive) {
+    std::vector<std::string> paths = sample(archive.files, 200000, 4);
+    for (auto & path : archive.large) paths.erase(std::remove(paths.begin(), paths.end(), path), paths.end());
+
+    Asar asar(file);
+    Asar cached(file);
+    cached.enableCache(256 << 20);
+
+    auto run = [&](const char * variant, auto && op) {
+      double single = 0;
+      for (unsigned threads : settings.threads) {
+        std::vector<std::thread> workers;
+        std::atomic<uint64_t> sink{0};
+
+        auto start = Clock::now();
+        for (unsigned t = 0; t < threads; t++)
+          workers.emplace_back([&, t] {
+            uint64_t local = 0;
+            for (size_t i = t; i < paths.size(); i += threads) local += op(paths[i]);
+            sink += local;
+          });
+        for (auto & worker : workers) worker.join();
+        double rate = paths.size() / seconds(Clock::now() - start);
+
+        if (threads == settings.threads.front()) single = rate / threads;
+        report("scaling", variant, "rate", rate, "ops/s", threads);
+        report("scaling", variant, "speedup", rate / single, "x", threads);
+      }
+    };
+
+    run("resolve", [&](const std::string & path) { return uint64_t(asar.resolve(path) != nullptr); });
+    run("unpack", [&](const std::string & path) { return uint64_t(asar.unpack(path).size()); });
+    run("unpackShared", [&](const std::string & path) { return uint64_t(cached.unpackShared(path)->size()); });
+  }
+
+  template <typename T>
+  std::vector<T> numbers(const char * text) {
+    std::vector<T> out;
+    std::stringstream list(text);
+    for (std::string item; std::getline(list, item, ',');) out.push_back(T(std::strtoull(item.c_str(), nullptr, 10)));
+    return out;
+  }
+
+  int usage() {
+    std::cerr <<
+      "usage: benchmark [options]\n"
+      "  --entries N,...      files per archive (default 1000,10000,100000)\n"
+      "  --depth N            directory levels (default 3)\n"
+      "  --name N             average name length (default 12)\n"
+      "  --sizes KIND         empty, small (64 B - 16 KiB) or mixed (small plus 16 - 64 MiB files)\n"
+      "  --integrity          write SHA-256 integrity blocks\n"
+      "  --seed N             generator seed (default 1)\n"
+      "  --threads N,...      thread counts for scaling/verify (default 1,2,4.. up to the core count)\n"
+      "  --runs N             repetitions for open times (default 5)\n"
+      "  --only LIST          open,lookup,small,large,range,extract,verify,pack,profile,repack,overlay,update,embedded,scaling\n"
+      "  --packer COMMAND     also time COMMAND pack <dir> <out>, e.g. \"npx @electron/asar\"\n"
+      "  --baseline-limit N   skip the json.hpp baseline above N entries (default 100000)\n"
+      "  --dir PATH           where archives are written (default /tmp)\n"
+      "  --label TEXT         copied into every record, e.g. a commit id\n"
+      "  --keep               keep the generated archives\n"
+      "  --generate FILE      only write an archive (first --entries value) and exit\n";
+    return 2;
+  }
+}
+
+int main(int argc, char ** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string option = argv[i];
+    const char * value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool flag = option == "--integrity" || option == "--keep";
+    if (!flag && !value) return usage();
+
+    if (option == "--entries") settings.entries = numbers<uint64_t>(value);
+    else if (option == "--depth") settings.options.depth = std::atoi(value);
+    else if (option == "--name") settings.options.nameLength = std::atoi(value);
+    else if (option == "--seed") settings.options.seed = std::strtoull(value, nullptr, 10);
+    else if (option == "--threads") settings.threads = numbers<unsigned>(value);
+    else if (option == "--runs") settings.runs = std::max(1, std::atoi(value));
+    else if (option == "--only") settings.only = value;
+    else if (option == "--baseline-limit") settings.baselineLimit = std::strtoull(value, nullptr, 10);
+    else if (option == "--dir") settings.directory = value;
+    else if (option == "--label") settings.label = value;
+    else if (option == "--generate") settings.generate = value;
+    else if (option == "--packer") settings.packer = value;
+    else if (option == "--integrity") settings.options.integrity = true;
+    else if (option == "--keep") settings.keep = true;
+    else if (option == "--sizes") {
+      std::string kind = value;
+      if (kind == "empty") settings.options.sizes = generator::Sizes::Empty;
+      else if (kind == "small") settings.options.sizes = generator::Sizes::Small;
+      else if (kind == "mixed") settings.options.sizes = generator::Sizes::Mixed;
+      else return usage();
+    }
+    else return usage();
+
+    if (!flag) i++;
+  }
+
+  if (settings.entries.empty()) return usage();
+
+  if (!settings.generate.empty()) {
+    settings.options.entries = settings.entries.front();
+    return generator::generate(settings.generate, settings.options).files.empty() ? 1 : 0;
+  }
+
+  if (settings.threads.empty())
+    for (unsigned t = 1; t <= std::max(1u, std::thread::hardware_concurrency()); t *= 2) settings.threads.push_back(t);
+
+  for (uint64_t entries : settings.entries) {
+    settings.options.entries = entries;
+    std::string file = settings.directory + "/asar-benchmark-" + std::to_string(entries) + "-" +
+      sizes(settings.options.sizes) + ".asar";
+
+    std::cerr << "generating " << file << "\n";
+    generator::Archive archive = generator::generate(file, settings.options);
+    if (archive.files.empty()) { std::cerr << "cannot write " << file << "\n"; return 1; }
+
+    report("archive", "generated", "header", archive.headerSize, "B");
+    report("archive", "generated", "data", archive.dataSize, "B");
+    report("archive", "generated", "directories", archive.directories, "count");
+
+    if (enabled("open")) { std::cerr << "open\n"; open(file, archive); }
+    if (enabled("lookup")) { std::cerr << "lookup\n"; lookup(file, archive); }
+    if (enabled("small")) { std::cerr << "small\n"; small(file, archive); }
+    if (enabled("large")) { std::cerr << "large\n"; large(file, archive); }
+    if (enabled("range")) { std::cerr << "range\n"; range(file, archive); }
+    if (enabled("extract")) { std::cerr << "extract\n"; extract(file, archive); }
+    if (enabled("verify")) { std::cerr << "verify\n"; verify(file, archive); }
+    if (enabled("pack")) { std::cerr << "pack\n"; pack(file, archive); }
+    if (enabled("profile")) { std::cerr << "profile\n"; profile(file, archive); }
+    if (enabled("repack")) { std::cerr << "repack\n"; repack(file, archive); }
+    if (enabled("overlay")) { std::cerr << "overlay\n"; overlay(file, archive); }
+    if (enabled("update")) { std::cerr << "update\n"; update(file, archive); }
+    if (enabled("embedded")) { std::cerr << "embedded\n"; embedded(file, archive); }
+    if (enabled("scaling")) { std::cerr << "scaling\n"; scaling(file, archive); }
+
+    if (!settings.keep) std::remove(file.c_str());
+  }
+
+  return 0;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_X86 1
+#endif
+
+namespace sha256 {
+  namespace {
+    alignas(16) const uint32_t K[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    inline void compressScalar(uint32_t state[8], const uint8_t * data, size_t blocks) {
+      for (; blocks--; data += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+          w[i] = uint32_t(data[i * 4]) << 24 | uint32_t(data[i * 4 + 1]) << 16 | uint32_t(data[i * 4 + 2]) << 8 | data[i * 4 + 3];
+        for (int i = 16; i < 64; i++) {
+          uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+          uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+          w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+          uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+          uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+          h = g; g = f; f = e; e = d + t1;
+          d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+      }
+    }
+
+#ifdef SHA256_X86
+    // SHA-NI: two rounds per sha256rnds2, message schedule via sha256msg1/2.
+    __attribute__((target("sha,sse4.1")))
+    inline void compressNative(uint32_t state[8], const uint8_t * data, size_t blocks) {
+      const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+
+      __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1); // CDAB
+      __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B); // EFGH
+      __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+      state1 = _mm_blend_epi16(state1, tmp, 0xF0); // CDGH
+
+      for (; blocks--; data += 64) {
+        __m128i abef = state0, cdgh = state1;
+        __m128i w[4];
+
+        for (int i = 0; i < 16; i++) {
+          if (i < 4) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), mask);
+          } else {
+            __m128i next = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+            next = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+            w[i & 3] = _mm_sha256msg2_epu32(next, w[(i + 3) & 3]);
+          }
+
+          __m128i msg = _mm_add_epi32(w[i & 3], _mm_load_si128((const __m128i *)&K[i * 4]));
+          state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+          state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+      }
+
+      tmp = _mm_shuffle_epi32(state0, 0x1B); // FEBA
+      state1 = _mm_shuffle_epi32(state1, 0xB1); // DCHG
+      _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0)); // DCBA
+      _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8)); // HGFE
+    }
+
+    inline bool native() {
+      static const bool supported = [] {
+        unsigned a, b, c, d;
+        if (!__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & (1u << 29))) return false; // SHA
+        if (!__get_cpuid(1, &a, &b, &c, &d)) return false;
+        return (c & (1u << 19)) != 0; // SSE4.1
+      }();
+      return supported;
+    }
+#endif
+
+    inline void compress(uint32_t state[8], const uint8_t * data, size_t blocks) {
+#ifdef SHA256_X86
+      if (native()) return compressNative(state, data, blocks);
+#endif
+      compressScalar(state, data, blocks);
+    }
+  }
+
+  // Incremental SHA-256: update() any number of times, then finish() once.
+  class Hasher {
+    public:
+      void update(const void * input, size_t size) {
+        if (!size) return;
+        const uint8_t * data = (const uint8_t *)input;
+        total += size;
+
+        if (used) {
+          size_t n = std::min(size, 64 - used);
+          std::memcpy(buffer + used, data, n);
+          used += n; data += n; size -= n;
+          if (used < 64) return;
+          compress(state, buffer, 1);
+          used = 0;
+        }
+
+        compress(state, data, size / 64);
+        data += size / 64 * 64;
+        size %= 64;
+
+        std::memcpy(buffer, data, size);
+        used = size;
+      }
+
+      void finish(uint8_t out[32]) {
+        uint8_t tail[128] = {};
+        std::memcpy(tail, buffer, used);
+        tail[used] = 0x80;
+
+        size_t blocks = used < 56 ? 1 : 2;
+        uint64_t bits = total * 8;
+        for (int i = 0; i < 8; i++) tail[blocks * 64 - 1 - i] = uint8_t(bits >> (i * 8));
+        compress(state, tail, blocks);
+
+        for (int i = 0; i < 8; i++) {
+          out[i * 4] = state[i] >> 24; out[i * 4 + 1] = state[i] >> 16;
+          out[i * 4 + 2] = state[i] >> 8; out[i * 4 + 3] = state[i];
+        }
+      }
+
+    private:
+      uint32_t state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+      };
+      uint8_t buffer[64];
+      size_t used = 0;
+      uint64_t total = 0;
+  };
+
+  // One-shot SHA-256 of size bytes; the CPU's SHA extensions are used when
+  // present, with a portable fallback.
+  inline void digest(const void * input, size_t size, uint8_t out[32]) {
+    Hasher hasher;
+    hasher.update(input, size);
+    hasher.finish(out);
+  }
+} // End Namespace sha256
@@ -0,0 +1,768 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define ASAR_STATS
+#include "../asar.hpp"
+#include "../benchmark/generator.hpp"
+
+// Tests for Asar against generated archives. Each test prints "ok <name>"
+// on stdout and every failed check on stderr; the exit status is 1 if any
+// check failed. The concurrency tests are meant to run under
+// ThreadSanitizer as well:
+//
+//   g++ -std=c++17 -O1 -g -pthread -fsanitize=thread test/main.cpp -o asar-test && ./asar-test
+
+namespace {
+  struct Settings {
+    uint64_t entries = 2000;
+    unsigned threads = 8;
+    unsigned rounds = 20000; // operations per thread
+    std::string directory = "/tmp";
+    std::string only;
+  } settings;
+
+  std::mutex output;
+  std::atomic<unsigned> failures{0};
+
+  void fail(const char * test, const std::string & what) {
+    std::lock_guard<std::mutex> lock(output);
+    std::cerr << "FAIL " << test << ": " << what << "\n";
+    failures++;
+  }
+
+  #define CHECK(test, condition, what) do { if (!(condition)) fail(test, what); } while (0)
+
+  bool enabled(const char * test) {
+    if (settings.only.empty()) return true;
+    std::stringstream list(settings.only);
+    for (std::string item; std::getline(list, item, ',');)
+      if (item == test) return true;
+    return false;
+  }
+
+  std::string file(const char * name) {
+    return settings.directory + "/asar-test-" + std::to_string(getpid()) + "-" + name + ".asar";
+  }
+
+  template <typename F>
+  void parallel(unsigned threads, F body) {
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; t++) pool.emplace_back(body, t);
+    for (auto & thread : pool) thread.join();
+  }
+
+  // What every path of an archive holds, read once on one thread, and
+  // paths that are not in it. With integrity blocks and verifyOnRead(),
+  // every read below is also checked against the header's digests.
+  struct Expected {
+    std::vector<std::string> files;
+    std::vector<std::string> data;
+    std::vector<std::string> directories;
+    std::vector<std::string> missing;
+  };
+
+  Expected expect(const std::string & archive, const generator::Archive & generated) {
+    Asar reference(archive);
+    reference.verifyOnRead(true);
+    Expected out;
+    for (const std::string & path : generated.files) {
+      out.files.push_back(path);
+      out.data.push_back(reference.unpack(path));
+      out.missing.push_back(path + ".missing");
+      out.missing.push_back("missing/" + path);
+      size_t slash = path.rfind('/');
+      if (slash != std::string::npos) out.directories.push_back(path.substr(0, slash));
+    }
+    out.missing.push_back("");
+    return out;
+  }
+
+  // N threads doing a random mix of hits (files and directories) and misses
+  // against one shared reader. get(path) returns the bytes read, or null
+  // for a miss.
+  template <typename Get>
+  void hammer(const char * test, const Expected & expected, Get get) {
+    parallel(settings.threads, [&](unsigned t) {
+      std::mt19937_64 random(t + 1);
+      for (unsigned i = 0; i < settings.rounds; i++) {
+        unsigned kind = random() % 4;
+        if (kind < 2) {
+          size_t k = random() % expected.files.size();
+          std::unique_ptr<std::string> data = get(expected.files[k]);
+          CHECK(test, data && *data == expected.data[k], "wrong data for " + expected.files[k]);
+        } else if (kind == 2) {
+          const std::string & path = expected.missing[random() % expected.missing.size()];
+          CHECK(test, !get(path), "hit for missing " + path);
+        } else if (!expected.directories.empty()) {
+          const std::string & path = expected.directories[random() % expected.directories.size()];
+          std::unique_ptr<std::string> data = get(path);
+          CHECK(test, data && data->empty(), "no directory at " + path);
+        }
+      }
+    });
+  }
+
+  std::unique_ptr<std::string> some(std::string data) {
+    return std::unique_ptr<std::string>(new std::string(std::move(data)));
+  }
+
+  // Hits and misses from many threads against eager, lazy, cached and
+  // overlay readers. Reads alternate between the access paths (unpack,
+  // view, read, Reader), and the lazy reader's directories are parsed by
+  // whichever thread gets there first.
+  void concurrency() {
+    generator::Options options;
+    options.entries = settings.entries;
+    options.integrity = true;
+    std::string base = file("concurrency");
+    generator::Archive generated = generator::generate(base, options);
+    CHECK("concurrency", !generated.files.empty(), "cannot write " + base);
+    if (generated.files.empty()) return;
+    Expected expected = expect(base, generated);
+
+    auto read = [](const Asar & asar, const std::string & path, unsigned how) -> std::unique_ptr<std::string> {
+      const Asar::Entry * e = asar.resolve(path);
+      if (!e) return nullptr;
+      if (e->isDirectory()) return some("");
+      switch (how % 4) {
+        case 0: return some(asar.unpack(path));
+        case 1: return some(std::string(asar.view(path)));
+        case 2: return some(asar.read(path, 0, e->size));
+        default: {
+          Asar::Reader reader = asar.open(path);
+          std::string data(reader.size(), '\0');
+          data.resize(reader.read(&data[0], data.size()));
+          return some(std::move(data));
+        }
+      }
+    };
+
+    for (Asar::Load mode : {Asar::Load::Eager, Asar::Load::Lazy}) {
+      Asar asar(base, mode);
+      asar.verifyOnRead(true);
+      std::atomic<unsigned> how{0};
+      hammer(mode == Asar::Load::Eager ? "concurrency eager" : "concurrency lazy", expected, [&](const std::string & path) {
+        return read(asar, path, how++);
+      });
+    }
+
+    // A small cache keeps evicting while the threads read.
+    Asar cached(base);
+    cached.verifyOnRead(true);
+    cached.enableCache(64 * 1024, 4);
+    hammer("concurrency cache", expected, [&](const std::string & path) -> std::unique_ptr<std::string> {
+      const Asar::Entry * e = cached.resolve(path);
+      if (!e) return nullptr;
+      if (e->isDirectory()) return some("");
+      std::shared_ptr<const std::string> data = cached.unpackShared(path);
+      return data ? some(*data) : some("<null>");
+    });
+    Asar::CacheStats stats = cached.cacheStats();
+    CHECK("concurrency cache", stats.hits && stats.misses && stats.evictions, "cache was not exercised");
+
+    // A patch layer is mounted while the threads read through the overlay:
+    // a replaced path reads as either version, never anything else.
+    std::string patch = file("concurrency-patch");
+    AsarWriter writer;
+    std::map<std::string, std::string> patched;
+    for (size_t i = 0; i < expected.files.size(); i += 7) {
+      patched[expected.files[i]] = "patched " + expected.files[i];
+      writer.addData(expected.files[i], patched[expected.files[i]]);
+    }
+    CHECK("concurrency overlay", writer.write(patch), "cannot write " + patch);
+
+    AsarOverlay overlay;
+    CHECK("concurrency overlay", overlay.mount(base, 0), "cannot mount " + base);
+    std::atomic<bool> mounted{false};
+    std::thread mounter([&] { mounted = overlay.mount(patch, 1); });
+    parallel(settings.threads, [&](unsigned t) {
+      std::mt19937_64 random(t + 1);
+      for (unsigned i = 0; i < settings.rounds; i++) {
+        size_t k = random() % expected.files.size();
+        const std::string & path = expected.files[k];
+        std::string data = overlay.unpack(path);
+        auto it = patched.find(path);
+        CHECK("concurrency overlay", data == expected.data[k] || (it != patched.end() && data == it->second), "wrong data for " + path);
+
+        const std::string & missing = expected.missing[random() % expected.missing.size()];
+        CHECK("concurrency overlay", !overlay.exist(missing), "hit for missing " + missing);
+      }
+    });
+    mounter.join();
+    CHECK("concurrency overlay", mounted, "cannot mount " + patch);
+    for (size_t i = 0; i < expected.files.size(); i++) {
+      auto it = patched.find(expected.files[i]);
+      CHECK("concurrency overlay", overlay.unpack(expected.files[i]) == (it != patched.end() ? it->second : expected.data[i]),
+        "wrong winner for " + expected.files[i]);
+    }
+
+    std::remove(base.c_str());
+    std::remove(patch.c_str());
+  }
+
+  // An Asar reading through pread(), as when the archive does not fit the
+  // address space: the soft RLIMIT_AS leaves too little room for the
+  // mapping while the constructor runs.
+  std::unique_ptr<Asar> unmapped(const std::string & archive, uint64_t length) {
+    std::ifstream status("/proc/self/status");
+    uint64_t used = 0;
+    for (std::string line; std::getline(status, line);)
+      if (line.compare(0, 7, "VmSize:") == 0) used = std::strtoull(line.c_str() + 7, nullptr, 10) * 1024;
+
+    rlimit old, low;
+    if (!used || getrlimit(RLIMIT_AS, &old)) return nullptr;
+    low = old;
+    low.rlim_cur = std::min<rlim_t>(old.rlim_cur, used + length - 1);
+    if (setrlimit(RLIMIT_AS, &low)) return nullptr;
+
+    std::unique_ptr<Asar> asar;
+    try { asar.reset(new Asar(archive)); } catch (const std::bad_alloc &) {}
+    setrlimit(RLIMIT_AS, &old);
+    return asar;
+  }
+
+  // The size fields and padded header an archive starts with.
+  std::string framed(std::string header) {
+    uint32_t length = header.size(), padded = (length + 3) & ~3u;
+    header.resize(padded, '\0');
+    std::string prefix;
+    for (uint32_t v : {4u, padded + 8, padded + 4, length})
+      for (int b = 0; b < 4; b++) prefix += char(v >> (b * 8));
+    return prefix + header;
+  }
+
+  // A sparse archive of more than 4 GiB: one entry below 4 GiB, one
+  // straddling it and one past it, so any offset or size squeezed through
+  // 32 bits reads the wrong bytes. Every access path is checked with the
+  // archive mapped and read through pread().
+  void sparse() {
+    const uint64_t four = uint64_t(1) << 32;
+    struct Item { const char * name; uint64_t offset, size; };
+    const Item items[] = {{"near", 0, 1000}, {"edge", four - 500, 1000}, {"far", four + 4321, 3 << 20}};
+
+    std::string header = "{\"files\":{";
+    for (const Item & item : items)
+      header += std::string(item.name == items[0].name ? "" : ",") + "\"" + item.name + "\":{\"size\":" +
+        std::to_string(item.size) + ",\"offset\":\"" + std::to_string(item.offset) + "\"}";
+    header = framed(header + "}}");
+
+    std::string archive = file("sparse");
+    uint64_t base = header.size(), total = base + items[2].offset + items[2].size;
+    std::map<std::string, std::string> data;
+    int fd = ::open(archive.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = fd >= 0 && ftruncate(fd, total) == 0 && pwrite(fd, header.data(), base, 0) == ssize_t(base);
+    for (const Item & item : items) {
+      std::string & bytes = data[item.name];
+      for (uint64_t i = 0; i < item.size; i++) bytes += char('a' + (item.offset + i * 7) % 26);
+      written = written && pwrite(fd, bytes.data(), bytes.size(), base + item.offset) == ssize_t(bytes.size());
+    }
+    if (fd >= 0) ::close(fd);
+    CHECK("sparse", written, "cannot write " + archive);
+    if (!written) { std::remove(archive.c_str()); return; }
+
+    auto check = [&](const char * test, const Asar & asar) {
+      for (const Item & item : items) {
+        const std::string & expected = data[item.name];
+        std::string name = item.name;
+        CHECK(test, asar.unpack(name) == expected, "unpack " + name);
+        CHECK(test, asar.read(name, item.size / 3, 700) == expected.substr(item.size / 3, 700), "read " + name);
+
+        Asar::Reader reader = asar.open(name);
+        std::string streamed(item.size, '\0');
+        CHECK(test, reader.size() == item.size && reader.seek(item.size / 2) &&
+          reader.read(&streamed[0], item.size) == item.size - item.size / 2 &&
+          streamed.compare(0, item.size - item.size / 2, expected, item.size / 2, std::string::npos) == 0, "open " + name);
+
+        std::string out = file("sparse-out");
+        int sink = ::open(out.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        std::string sent(item.size, '\0');
+        CHECK(test, sink >= 0 && asar.sendTo(name, sink, 1, item.size) &&
+          pread(sink, &sent[0], item.size, 0) == ssize_t(item.size - 1) && sent.compare(0, item.size - 1, expected, 1, std::string::npos) == 0,
+          "sendTo " + name);
+        if (sink >= 0) ::close(sink);
+        std::remove(out.c_str());
+      }
+
+      std::vector<std::string> many = asar.unpackMany({"far", "near", "edge", "far", "missing"});
+      CHECK(test, many.size() == 5 && many[0] == data["far"] && many[1] == data["near"] && many[2] == data["edge"] &&
+        many[3] == data["far"] && many[4].empty(), "unpackMany");
+    };
+
+    {
+      Asar asar(archive);
+      CHECK("sparse mapped", asar.view("far").size() == items[2].size, "not mapped");
+      check("sparse mapped", asar);
+    }
+
+    std::unique_ptr<Asar> plain = unmapped(archive, total);
+    CHECK("sparse unmapped", plain && !plain->view("far").data(), "cannot open without a mapping");
+    if (plain) check("sparse unmapped", *plain);
+
+    std::remove(archive.c_str());
+  }
+
+  uint64_t pss() {
+    std::ifstream rollup("/proc/self/smaps_rollup");
+    for (std::string line; std::getline(rollup, line);)
+      if (line.compare(0, 4, "Pss:") == 0) return std::strtoull(line.c_str() + 4, nullptr, 10) * 1024;
+    return 0;
+  }
+
+  // Worker processes forked after shareIndex() attach to the parent's index
+  // with Asar(file, descriptor). While all of them are alive, each one's
+  // proportional set size grows by a share of the index, not by a copy of
+  // it; a worker that parses the header itself is the comparison.
+  void fork() {
+    static constexpr unsigned workers = 4;
+    generator::Options options;
+    options.entries = std::max<uint64_t>(settings.entries, 100000);
+    options.sizes = generator::Sizes::Empty;
+    std::string base = file("fork");
+    generator::Archive generated = generator::generate(base, options);
+    CHECK("fork", !generated.files.empty(), "cannot write " + base);
+    if (generated.files.empty()) return;
+
+    Asar parent(base);
+    int shared = parent.shareIndex();
+    struct stat image;
+    CHECK("fork", shared >= 0 && fstat(shared, &image) == 0, "cannot share the index");
+    CHECK("fork", pss(), "cannot read /proc/self/smaps_rollup");
+    if (shared < 0 || !pss()) { std::remove(base.c_str()); return; }
+
+    // Pages the processes share are split between however many are alive,
+    // so the children measure between barriers: before, once all of them
+    // are forked, and after, once all of them have looked up every path;
+    // none exits before all have measured.
+    struct Barrier {
+      int up[2], down[2];
+      bool open() { return pipe(up) == 0 && pipe(down) == 0; }
+      bool arrive() { // child
+        char c = 0;
+        return ::write(up[1], &c, 1) == 1 && ::read(down[0], &c, 1) == 0;
+      }
+      void release(unsigned count) { // parent, once count children arrived
+        char c;
+        for (unsigned w = 0; w < count && ::read(up[0], &c, 1) == 1; w++) {}
+        ::close(down[1]);
+      }
+    };
+
+    auto run = [&](unsigned count, bool attach) {
+      Barrier forked, done, measured;
+      int results[2];
+      if (!forked.open() || !done.open() || !measured.open() || pipe(results)) return std::vector<uint64_t>();
+
+      for (unsigned w = 0; w < count; w++) {
+        if (::fork() != 0) continue;
+        for (int end : {forked.down[1], done.down[1], measured.down[1]}) ::close(end);
+
+        bool ok = forked.arrive();
+        uint64_t before = pss();
+        std::unique_ptr<Asar> worker(attach ? new Asar(base, shared) : new Asar(base));
+        for (const std::string & path : generated.files) ok = ok && worker->exist(path) && !worker->exist(path + ".missing");
+        ok = done.arrive() && ok;
+
+        uint64_t after = pss(), growth = ok ? after - std::min(before, after) : ~uint64_t(0);
+        ok = ::write(results[1], &growth, sizeof growth) == sizeof growth;
+        _exit(measured.arrive() && ok ? 0 : 1);
+      }
+
+      ::close(results[1]);
+      for (Barrier * b : {&forked, &done, &measured}) { ::close(b->up[1]); ::close(b->down[0]); }
+      forked.release(count);
+      done.release(count);
+      measured.release(count);
+
+      std::vector<uint64_t> growth;
+      for (uint64_t g; ::read(results[0], &g, sizeof g) == sizeof g;) growth.push_back(g);
+      for (Barrier * b : {&forked, &done, &measured}) ::close(b->up[0]);
+      ::close(results[0]);
+      while (wait(nullptr) > 0) {}
+      return growth;
+    };
+
+    std::vector<uint64_t> attached = run(workers, true), parsed = run(1, false);
+    CHECK("fork", attached.size() == workers && parsed.size() == 1, "a worker failed");
+    if (attached.size() == workers && parsed.size() == 1) {
+      uint64_t most = *std::max_element(attached.begin(), attached.end());
+      CHECK("fork", most != ~uint64_t(0) && parsed[0] != ~uint64_t(0), "wrong lookups in a worker");
+#ifndef __SANITIZE_THREAD__ // shadow memory would be counted as growth
+      CHECK("fork", most < uint64_t(image.st_size) / 2,
+        "attached worker grew by " + std::to_string(most >> 10) + " KiB, the index is " + std::to_string(image.st_size >> 10) + " KiB");
+      CHECK("fork", most * 2 < parsed[0],
+        "attached worker grew by " + std::to_string(most >> 10) + " KiB, a parsing one by " + std::to_string(parsed[0] >> 10) + " KiB");
+#endif
+    }
+
+    ::close(shared);
+    std::remove(base.c_str());
+  }
+
+  // Electron's packer hashes the empty rest after a full last block, so an
+  // entry of exactly 4 MiB has two block digests. AsarWriter writes them
+  // that way, and archives from packers that leave the empty one out still
+  // verify; a wrong extra digest does not.
+  void blocks() {
+    const uint64_t four = 4 << 20;
+    std::string archive = file("blocks");
+    AsarWriter writer;
+    const std::pair<const char *, uint64_t> sizes[] = {{"empty", 0}, {"four", four}, {"odd", four + 1}, {"eight", 2 * four}};
+    for (auto & size : sizes) writer.addData(size.first, std::string(size.second, 'x'));
+    CHECK("blocks", writer.write(archive), "cannot write " + archive);
+
+    std::string bytes;
+    {
+      std::ifstream in(archive, std::ios::binary);
+      bytes.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    for (auto & size : sizes) {
+      size_t at = bytes.find(std::string("\"") + size.first + "\":");
+      size_t from = bytes.find("\"blocks\":[", at), to = bytes.find(']', from);
+      uint64_t count = at == std::string::npos ? 0 : std::count(bytes.begin() + from, bytes.begin() + to, '"') / 2 - 1;
+      CHECK("blocks", count == size.second / four + 1, std::string(size.first) + " has " + std::to_string(count) + " block digests");
+    }
+    Asar written(archive);
+    written.verifyOnRead(true);
+    CHECK("blocks", written.verifyAll() && written.unpack("four") == std::string(four, 'x'), "written archive does not verify");
+
+    auto hex = [](std::string_view data) {
+      uint8_t digest[32];
+      sha256::digest(data.data(), data.size(), digest);
+      std::string out;
+      for (uint8_t b : digest) out += "0123456789abcdef"[b >> 4], out += "0123456789abcdef"[b & 15];
+      return out;
+    };
+    std::string content(four, 'y');
+    auto packed = [&](const std::string & blocks) {
+      return framed("{\"files\":{\"four\":{\"size\":" + std::to_string(four) + ",\"offset\":\"0\",\"integrity\":{" +
+        "\"algorithm\":\"SHA256\",\"hash\":\"" + hex(content) + "\",\"blockSize\":" + std::to_string(four) +
+        ",\"blocks\":[" + blocks + "]}}}}") + content;
+    };
+    const std::pair<std::string, bool> cases[] = {
+      {'"' + hex(content) + '"', true},
+      {'"' + hex(content) + "\",\"" + hex("") + '"', true},
+      {'"' + hex(content) + "\",\"" + hex("y") + '"', false},
+    };
+    for (auto & c : cases) {
+      std::string image = packed(c.first);
+      Asar asar(Asar::Memory{image.data(), image.size()});
+      CHECK("blocks", asar.verify("four") == c.second && asar.verifyAll() == c.second,
+        std::string(c.second ? "rejected " : "accepted ") + c.first);
+    }
+
+    std::remove(archive.c_str());
+  }
+
+  // The cache budget holds across shards, not per shard: entries larger
+  // than a shard's share are cached and together stay within the budget.
+  // A failed read is null with or without the cache.
+  void cache() {
+    const size_t size = 2 << 20, budget = 16 << 20;
+    std::string archive = file("cache");
+    AsarWriter writer;
+    for (int i = 0; i < 12; i++) writer.addData("big" + std::to_string(i), std::string(size, char('a' + i)));
+    CHECK("cache", writer.write(archive), "cannot write " + archive);
+
+    Asar asar(archive);
+    asar.enableCache(budget, 16);
+    std::shared_ptr<const std::string> first = asar.unpackShared("big0");
+    CHECK("cache", first && first == asar.unpackShared("big0"), "an entry over a shard's share was not cached");
+    for (int i = 1; i < 12; i++) asar.unpackShared("big" + std::to_string(i));
+    Asar::CacheStats stats = asar.cacheStats();
+    CHECK("cache", stats.bytes == budget && stats.evictions == 4,
+      "cache holds " + std::to_string(stats.bytes) + " bytes after " + std::to_string(stats.evictions) + " evictions");
+
+    std::string truncated = framed("{\"files\":{\"gone\":{\"size\":100,\"offset\":\"0\"}}}");
+    Asar broken(Asar::Memory{truncated.data(), truncated.size()});
+    CHECK("cache", broken.exist("gone") && !broken.unpackShared("gone"), "failed read without the cache was not null");
+    broken.enableCache(budget);
+    CHECK("cache", !broken.unpackShared("gone"), "failed read with the cache was not null");
+
+    std::remove(archive.c_str());
+  }
+
+  // list(), walk() and glob() where siblings sort between a directory and
+  // its children: '-' and '.' come before '/', so "lodash-es" and
+  // "lodash.debounce" lie between "lodash" and "lodash/index.js".
+  void queries() {
+    std::string archive = file("queries");
+    AsarWriter writer;
+    for (const char * path : {"node_modules/lodash/index.js", "node_modules/lodash/fp/map.js", "node_modules/lodash-es/index.js",
+      "node_modules/lodash.debounce/index.js", "node_modules/zz.js", "node_modules-old/a.js", "top.js"})
+      writer.addData(path, path);
+    CHECK("queries", writer.write(archive), "cannot write " + archive);
+
+    for (Asar::Load mode : {Asar::Load::Eager, Asar::Load::Lazy}) {
+      const char * test = mode == Asar::Load::Eager ? "queries eager" : "queries lazy";
+      Asar asar(archive, mode);
+      auto paths = [&](const auto & entries) {
+        std::string out;
+        for (const Asar::Entry & e : entries) out += std::string(asar.path(e)) + " ";
+        return out;
+      };
+
+      std::string list = paths(asar.list("node_modules"));
+      CHECK(test, list == "node_modules/lodash node_modules/lodash-es node_modules/lodash.debounce node_modules/zz.js ",
+        "list(node_modules): " + list);
+      list = paths(asar.list("/"));
+      CHECK(test, list == "node_modules node_modules-old top.js ", "list(/): " + list);
+      list = paths(asar.list("node_modules/lodash"));
+      CHECK(test, list == "node_modules/lodash/fp node_modules/lodash/index.js ", "list(node_modules/lodash): " + list);
+
+      std::string walk = paths(asar.walk("node_modules/lodash"));
+      CHECK(test, walk == "node_modules/lodash/fp node_modules/lodash/fp/map.js node_modules/lodash/index.js ",
+        "walk(node_modules/lodash): " + walk);
+      CHECK(test, asar.list("missing").empty() && asar.walk("missing").empty() && asar.walk("top.js").empty(), "entries below a miss or a file");
+
+      std::string glob;
+      for (const Asar::Entry * e : asar.glob("node_modules/lodash*/index.js")) glob += std::string(asar.path(*e)) + " ";
+      CHECK(test, glob == "node_modules/lodash-es/index.js node_modules/lodash.debounce/index.js node_modules/lodash/index.js ",
+        "glob(node_modules/lodash*/index.js): " + glob);
+    }
+
+    std::remove(archive.c_str());
+  }
+
+  // Lookup counters see the caller's lookups only, once each; the
+  // per-thread meter blocks of destroyed Asars do not pile up.
+  void stats() {
+    std::string archive = file("stats");
+    std::string profile = archive + ".profile";
+    AsarWriter writer;
+    for (const char * path : {"a/one.js", "a/two.js", "b/three.js"}) writer.addData(path, path);
+    CHECK("stats", writer.write(archive), "cannot write " + archive);
+    std::ofstream(profile) << "a/one.js\nb/three.js\nmissing\n";
+
+    auto lookups = [](const Asar & asar, const char * call, auto && body) {
+      uint64_t before = asar.stats().lookups;
+      body();
+      return std::string(call) + " counted " + std::to_string(asar.stats().lookups - before) + " lookups";
+    };
+
+    Asar asar(archive);
+    std::string counted = lookups(asar, "unpackShared", [&] { asar.unpackShared("a/one.js"); });
+    CHECK("stats", counted == "unpackShared counted 1 lookups", counted);
+    counted = lookups(asar, "unpackMany", [&] { asar.unpackMany({"a/one.js", "a/two.js", "missing"}); });
+    CHECK("stats", counted == "unpackMany counted 3 lookups", counted);
+    counted = lookups(asar, "glob", [&] { asar.glob("a/*.js"); asar.glob("a/one.js"); });
+    CHECK("stats", counted == "glob counted 0 lookups", counted);
+    counted = lookups(asar, "verify", [&] { asar.verify("a/one.js"); });
+    CHECK("stats", counted == "verify counted 0 lookups", counted);
+    counted = lookups(asar, "prefetch", [&] { asar.prefetch(profile); });
+    CHECK("stats", counted == "prefetch counted 0 lookups", counted);
+
+    asar.enableCache(1 << 20);
+    counted = lookups(asar, "cached unpackShared", [&] { asar.unpackShared("a/one.js"); asar.unpackShared("a/one.js"); });
+    CHECK("stats", counted == "cached unpackShared counted 2 lookups", counted);
+
+#ifdef __GLIBC__
+    // Each Asar used to leave an entry in every thread that counted for it.
+    std::string bytes;
+    {
+      std::ifstream in(archive, std::ios::binary);
+      bytes.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    auto heap = [] { return mallinfo2().uordblks; };
+    for (int i = 0; i < 1000; i++) Asar(Asar::Memory{bytes.data(), bytes.size()}).exist("a/one.js");
+    size_t before = heap();
+    for (int i = 0; i < 100000; i++) Asar(Asar::Memory{bytes.data(), bytes.size()}).exist("a/one.js");
+    size_t growth = heap() - std::min(before, heap());
+    CHECK("stats", growth < 64 * 1024, "100000 short-lived Asars left " + std::to_string(growth) + " bytes behind");
+#endif
+
+    std::remove(archive.c_str());
+    std::remove(profile.c_str());
+  }
+
+  // Lookups through links: chains, links to directories inside linked
+  // directories, cycles and links to files in the middle of a path, in
+  // every way an index gets built.
+  void links() {
+    std::string archive = file("links"), index = archive + ".idx";
+    AsarWriter writer;
+    writer.addData("lib/x.js", "x");
+    writer.addData("lib/inner/y.js", "y");
+    writer.addLink("lib/in", "lib/inner");
+    writer.addLink("l", "lib");
+    writer.addLink("m", "l");
+    writer.addLink("f", "lib/x.js");
+    writer.addLink("loop", "loop2");
+    writer.addLink("loop2", "loop");
+    CHECK("links", writer.write(archive), "cannot write " + archive);
+
+    auto check = [&](const char * test, const Asar & asar) {
+      const std::pair<const char *, const char *> hits[] = {{"l/x.js", "x"}, {"m/x.js", "x"}, {"f", "x"}, {"m/in/y.js", "y"}, {"l/inner/y.js", "y"}};
+      for (auto & hit : hits) {
+        const Asar::Entry * e = asar.resolve(hit.first);
+        CHECK(test, e && !e->isDirectory() && asar.unpack(hit.first) == hit.second, std::string("wrong entry for ") + hit.first);
+      }
+      const Asar::Entry * dir = asar.resolve("m/in");
+      CHECK(test, dir && dir->isDirectory(), "m/in is not a directory");
+      for (const char * path : {"f/x.js", "l/missing", "m/in/missing", "loop", "loop/x.js", "missing/x.js"})
+        CHECK(test, !asar.resolve(path), std::string("hit for ") + path);
+    };
+    check("links eager", Asar(archive));
+    check("links lazy", Asar(archive, Asar::Load::Lazy));
+    for (const char * pass : {"saved", "loaded"}) {
+      Asar indexed(archive, index);
+      check(pass == std::string("saved") ? "links saved index" : "links loaded index", indexed);
+    }
+
+    std::remove(archive.c_str());
+    std::remove(index.c_str());
+  }
+
+  // A patch layer that turns a directory of the base into a file hides
+  // the base's entries below it; one that turns it into a link resolves
+  // them in the patch. The base's own link still resolves in the base.
+  // Either mount order gives the same view.
+  void overlay() {
+    std::string base = file("overlay-base"), hide = file("overlay-hide"), swap = file("overlay-swap");
+    AsarWriter writer;
+    for (const char * path : {"a/b.js", "c/d.js", "c/e.js", "keep.js"}) writer.addData(path, std::string("base ") + path);
+    writer.addLink("l", "c");
+    CHECK("overlay", writer.write(base), "cannot write " + base);
+
+    AsarWriter hiding;
+    hiding.addData("a", "file a");
+    CHECK("overlay", hiding.write(hide), "cannot write " + hide);
+
+    AsarWriter swapping;
+    swapping.addData("z/d.js", "patch z/d.js");
+    swapping.addLink("c", "z");
+    CHECK("overlay", swapping.write(swap), "cannot write " + swap);
+
+    for (bool baseFirst : {true, false}) {
+      const char * test = baseFirst ? "overlay base first" : "overlay patches first";
+      AsarOverlay tree;
+      if (baseFirst) CHECK(test, tree.mount(base, 0), "cannot mount " + base);
+      CHECK(test, tree.mount(hide, 1) && tree.mount(swap, 1), "cannot mount the patches");
+      if (!baseFirst) CHECK(test, tree.mount(base, 0), "cannot mount " + base);
+
+      CHECK(test, tree.unpack("a") == "file a" && !tree.exist("a/b.js"), "a file did not hide the directory below it");
+      CHECK(test, tree.unpack("c/d.js") == "patch z/d.js" && !tree.exist("c/e.js"), "a link did not replace the directory");
+      CHECK(test, tree.unpack("l/d.js") == "base c/d.js" && tree.exist("l/e.js"), "the base's link did not resolve in the base");
+      CHECK(test, tree.unpack("keep.js") == "base keep.js" && !tree.exist("a/missing") && !tree.exist("missing/x"), "other paths");
+    }
+
+    for (const std::string & path : {base, hide, swap}) std::remove(path.c_str());
+  }
+
+  // repack() puts the entries of the order first, in order, also when the
+  // order names them through a link or a linked directory.
+  void repack() {
+    std::string archive = file("repack"), packed = file("repack-packed");
+    AsarWriter writer;
+    writer.addData("a.js", std::string(1000, 'a'));
+    writer.addData("lib/real.js", std::string(2000, 'r'));
+    writer.addData("lib/x.js", std::string(3000, 'x'));
+    writer.addLink("alias.js", "lib/real.js");
+    writer.addLink("l", "lib");
+    CHECK("repack", writer.write(archive), "cannot write " + archive);
+
+    for (Asar::Load mode : {Asar::Load::Eager, Asar::Load::Lazy}) {
+      const char * test = mode == Asar::Load::Eager ? "repack eager" : "repack lazy";
+      CHECK(test, Asar(archive, mode).repack(packed, {"alias.js", "l/x.js", "missing"}), "cannot repack " + archive);
+
+      Asar out(packed);
+      const Asar::Entry * real = out.resolve("lib/real.js"), * x = out.resolve("lib/x.js"), * a = out.resolve("a.js");
+      CHECK(test, real && x && a && real->offset == 0 && x->offset == real->size && a->offset == real->size + x->size,
+        "linked entries were not laid out first");
+      CHECK(test, out.unpack("alias.js") == std::string(2000, 'r') && out.unpack("l/x.js") == std::string(3000, 'x') &&
+        out.unpack("a.js") == std::string(1000, 'a'), "wrong data after repack");
+    }
+
+    std::remove(archive.c_str());
+    std::remove(packed.c_str());
+  }
+
+  // An update interrupted after an earlier one committed leaves bytes past
+  // the last trailer; readers still see the committed header, the next
+  // update cuts them off.
+  void interrupted() {
+    std::string archive = file("interrupted"), index = archive + ".idx";
+    AsarWriter writer;
+    writer.addData("config.json", "v0");
+    writer.addData("keep.js", "keep");
+    CHECK("interrupted", writer.write(archive), "cannot write " + archive);
+
+    AsarUpdater update(archive);
+    update.addData("config.json", "v1-committed");
+    CHECK("interrupted", update.write(), "cannot update " + archive);
+    std::ofstream(archive, std::ios::binary | std::ios::app) << "garbage\x01\x02\x03\x04\x05";
+
+    std::string bytes;
+    {
+      std::ifstream in(archive, std::ios::binary);
+      bytes.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    auto seen = [](const Asar & asar) { return asar.unpack("config.json") + " " + asar.unpack("keep.js"); };
+    CHECK("interrupted eager", seen(Asar(archive)) == "v1-committed keep", seen(Asar(archive)));
+    CHECK("interrupted lazy", seen(Asar(archive, Asar::Load::Lazy)) == "v1-committed keep", seen(Asar(archive, Asar::Load::Lazy)));
+    CHECK("interrupted memory", seen(Asar(Asar::Memory{bytes.data(), bytes.size()})) == "v1-committed keep", "wrong header in memory");
+    for (const char * pass : {"saved", "loaded"})
+      CHECK("interrupted index", seen(Asar(archive, index)) == "v1-committed keep", std::string("wrong header with the index ") + pass);
+
+    AsarUpdater next(archive);
+    next.addData("config.json", "v2");
+    CHECK("interrupted", next.write(), "cannot update " + archive);
+    std::ifstream in(archive, std::ios::binary);
+    std::string after(std::istreambuf_iterator<char>(in), {});
+    CHECK("interrupted", after.find("garbage") == std::string::npos, "leftovers were not cut off");
+    CHECK("interrupted", seen(Asar(archive)) == "v2 keep", seen(Asar(archive)));
+
+    std::remove(archive.c_str());
+    std::remove(index.c_str());
+  }
+
+  int usage() {
+    std::cerr <<
+      "usage: test [options]\n"
+      "  --entries N    files in generated archives (default 2000)\n"
+      "  --threads N    reader threads (default 8)\n"
+      "  --rounds N     operations per thread (default 20000)\n"
+      "  --only LIST    concurrency,sparse,blocks,cache,fork,queries,stats,links,overlay,repack,interrupted\n"
+      "  --dir PATH     where archives are written (default /tmp)\n";
+    return 2;
+  }
+}
+
+int main(int argc, char ** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string option = argv[i];
+    const char * value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) return usage();
+
+    if (option == "--entries") settings.entries = std::strtoull(value, nullptr, 10);
+    else if (option == "--threads") settings.threads = std::max(1, std::atoi(value));
+    else if (option == "--rounds") settings.rounds = std::strtoul(value, nullptr, 10);
+    else if (option == "--only") settings.only = value;
+    else if (option == "--dir") settings.directory = value;
+    else return usage();
+    i++;
+  }
+
+  struct Test { const char * name; void (*run)(); };
+  for (Test test : {Test{"concurrency", concurrency}, Test{"sparse", sparse}, Test{"blocks", blocks}, Test{"cache", cache}, Test{"fork", fork}, Test{"queries", queries}, Test{"stats", stats}, Test{"links", links}, Test{"overlay", overlay}, Test{"repack", repack}, Test{"interrupted", interrupted}}) {
+    if (!enabled(test.name)) continue;
+    unsigned before = failures;
+    test.run();
+    if (failures == before) std::cout << "ok " << test.name << std::endl;
+  }
+
+  return failures ? 1 : 0;
+}